@@ -0,0 +1,596 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include "server.h"
+#include "relay.h"
+
+// Microbenchmarks for the server's hot paths, driven in-process through the
+// same functions the packet workers use. Results are printed as JSON so that
+// runs from different commits can be diffed or compared by a script.
+
+#define MIN_RUN_TIME 0.2 // Seconds each measurement should last
+#define RUNS 3           // Best of
+#define LOOPBACK_MESSAGES 100000
+#define LOOPBACK_WINDOW 32 // Requests in flight against a loopback server
+
+typedef void (*Kernel)(void *arg, uint64_t iterations);
+
+const uint32_t table_sizes[] = {256, 4096, 65536};
+int result_count = 0;
+volatile uint64_t sink_value; // Keeps the compiler from dropping work
+uint32_t last_yiaddr;         // Address in the last reply
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Grows the iteration count until a run takes MIN_RUN_TIME, then keeps the
+// fastest of RUNS runs. Returns nanoseconds per operation
+double measure(Kernel kernel, void *arg, uint64_t *iterations_out)
+{
+    uint64_t iterations = 1;
+    double elapsed;
+    while (1)
+    {
+        double start = now();
+        kernel(arg, iterations);
+        elapsed = now() - start;
+        if (elapsed >= MIN_RUN_TIME / 4 || iterations >= (1ull << 34))
+            break;
+        iterations *= 2;
+    }
+    iterations = (uint64_t)(iterations * (MIN_RUN_TIME / elapsed)) + 1;
+
+    double best = 1e30;
+    for (int run = 0; run < RUNS; run++)
+    {
+        double start = now();
+        kernel(arg, iterations);
+        elapsed = now() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+    *iterations_out = iterations;
+    return best * 1e9 / iterations;
+}
+
+void report(const char *name, uint32_t table_size, Kernel kernel, void *arg)
+{
+    uint64_t iterations;
+    double ns = measure(kernel, arg, &iterations);
+    printf("%s\n    {\"name\": \"%s\", \"table_size\": %u, \"iterations\": %lu, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f}",
+           result_count++ ? "," : "", name, table_size, iterations, ns, 1e9 / ns);
+    fflush(stdout);
+}
+
+void make_request(DHCPMessage *msg, size_t *len, uint8_t type, uint32_t id, uint32_t requested_ip, uint32_t ciaddr)
+{
+    memset(msg, 0, sizeof(*msg));
+    msg->op = 1; // BOOTREQUEST
+    msg->htype = 1;
+    msg->hlen = 6;
+    msg->xid = htonl(id);
+    msg->ciaddr = ciaddr;
+    msg->chaddr[0] = 0x02;
+    memcpy(&msg->chaddr[2], &id, 4);
+
+    // A realistic option list, not just the message type
+    uint8_t *options = msg->options;
+    size_t i = 0;
+    options[i++] = 0x63; // Magic cookie
+    options[i++] = 0x82;
+    options[i++] = 0x53;
+    options[i++] = 0x63;
+    options[i++] = 53; // DHCP Message Type
+    options[i++] = 1;
+    options[i++] = type;
+    options[i++] = 61; // Client Identifier
+    options[i++] = 7;
+    options[i++] = 1;
+    memcpy(&options[i], msg->chaddr, 6);
+    i += 6;
+    if (requested_ip)
+    {
+        options[i++] = 50; // Requested IP Address
+        options[i++] = 4;
+        memcpy(&options[i], &requested_ip, 4);
+        i += 4;
+    }
+    options[i++] = 12; // Host Name
+    options[i++] = 8;
+    memcpy(&options[i], "bench-pc", 8);
+    i += 8;
+    options[i++] = 60; // Vendor Class Identifier
+    options[i++] = 8;
+    memcpy(&options[i], "MSFT 5.0", 8);
+    i += 8;
+    options[i++] = 55; // Parameter Request List
+    options[i++] = 6;
+    memcpy(&options[i], "\x01\x03\x06\x0f\x33\x3a", 6);
+    i += 6;
+    options[i++] = 255; // End option
+    *len = DHCP_HEADER_SIZE + i;
+}
+
+void discard_reply(void *arg, DHCPMessage *reply, struct sockaddr_in *dest)
+{
+    last_yiaddr = reply->yiaddr;
+}
+
+ReplySink null_sink = {-1, discard_reply, NULL};
+struct sockaddr_in client_addr;
+
+// Empties the lease table and sets up a single pool of the given size.
+// Under the mutex, like the expiry sweeps that walk the table
+AddressPool *reset_pool(uint32_t size)
+{
+    pthread_mutex_lock(&mutex);
+    memset(ip_leases, 0, sizeof(IPLease) * lease_slots);
+    lease_slots = 0;
+    lease_count = 0;
+    pool_count = 0;
+
+    struct in_addr start, end;
+    start.s_addr = htonl(0x0a000000 + 2); // 10.0.0.2
+    end.s_addr = htonl(ntohl(start.s_addr) + size - 1);
+    AddressPool *pool = add_pool(start, end);
+    pthread_mutex_unlock(&mutex);
+    return pool;
+}
+
+// Binds the first count addresses of the pool through the normal DORA path
+void fill_pool(AddressPool *pool, uint32_t count)
+{
+    DHCPMessage msg;
+    size_t len;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t ip = htonl(ntohl(pool->range_start.s_addr) + i);
+        make_request(&msg, &len, DHCPREQUEST, i, ip, 0);
+        process_dhcp_message(&null_sink, &msg, len, &client_addr);
+    }
+}
+
+DHCPMessage request;
+size_t request_len;
+
+void kernel_parse_options(void *arg, uint64_t iterations)
+{
+    DHCPMessage *msg = arg;
+    DHCPOptions opts;
+    size_t len = request_len;
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        dhcp_index_options(msg, len, &opts);
+        sink_value += opts.message_type;
+    }
+}
+
+void kernel_encode_template(void *arg, uint64_t iterations)
+{
+    DHCPMessage *msg = arg;
+    DHCPMessage reply;
+    LeaseTimes times = {3600, 1800, 3150};
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        build_reply(&reply, &pools[0].ack_template, msg, (uint32_t)i, &times);
+        sink_value += reply.options[10];
+    }
+}
+
+void kernel_encode_options(void *arg, uint64_t iterations)
+{
+    DHCPMessage reply;
+    LeaseTimes times = {3600, 1800, 3150};
+    memset(&reply, 0, sizeof(reply));
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        times.lease_time = (uint32_t)i;
+        set_reply_options(reply.options, DHCPACK, &times);
+        sink_value += reply.options[10];
+    }
+}
+
+void kernel_allocate(void *arg, uint64_t iterations)
+{
+    for (uint64_t i = 0; i < iterations; i++)
+        sink_value += get_available_ip(NULL).s_addr;
+}
+
+void kernel_classify(void *arg, uint64_t iterations)
+{
+    DHCPMessage *msg = arg;
+    DHCPOptions opts;
+    dhcp_index_options(msg, request_len, &opts);
+    for (uint64_t i = 0; i < iterations; i++)
+        sink_value += (uintptr_t)classify(msg, &opts);
+}
+
+// Writes count classes keyed on every criterion, the last one matching the
+// benchmark requests' vendor class, so classify walks past all the others
+int write_classes(const char *path, int count)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return -1;
+    for (int c = 0; c < count - 1; c++)
+    {
+        switch (c % 4)
+        {
+        case 0:
+            fprintf(file, "class v%d vendor=MSFT-%d dns=10.%d.0.53\n", c, c, c % 256);
+            break;
+        case 1:
+            fprintf(file, "class o%d oui=02:%02x:%02x option=66:tftp%d\n", c, c / 256, c % 256, c);
+            break;
+        case 2:
+            fprintf(file, "class u%d user=site%d vendor=MSFT router=10.0.0.%d\n", c, c, c % 254 + 1);
+            break;
+        default:
+            fprintf(file, "class r%d circuit=eth%d remote=\"switch %d\" domain=r%d.lab\n", c, c, c / 16, c);
+        }
+    }
+    fprintf(file, "class last vendor=MSFT option=43:0x0102\n");
+    fclose(file);
+    return 0;
+}
+
+void kernel_lookup_ip(void *arg, uint64_t iterations)
+{
+    AddressPool *pool = arg;
+    uint32_t size = pool_size(pool);
+    uint32_t base = ntohl(pool->range_start.s_addr);
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        struct in_addr ip;
+        ip.s_addr = htonl(base + (uint32_t)(i * 2654435761u) % size);
+        sink_value += find_lease_slot(ip)->seq;
+    }
+}
+
+// The server has no MAC index, so this is the cost of the scan one would do
+void kernel_lookup_mac(void *arg, uint64_t iterations)
+{
+    AddressPool *pool = arg;
+    uint32_t bound = pool->active;
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        uint8_t chaddr[16] = {0x02, 0};
+        uint32_t id = (uint32_t)(i * 2654435761u) % bound;
+        memcpy(&chaddr[2], &id, 4);
+        for (uint32_t slot = 0; slot < lease_slots; slot++)
+        {
+            if (ip_leases[slot].ip.s_addr && memcmp(ip_leases[slot].chaddr, chaddr, 16) == 0)
+            {
+                sink_value += slot;
+                break;
+            }
+        }
+    }
+}
+
+void kernel_expire_sweep(void *arg, uint64_t iterations)
+{
+    // Nothing is due, so this is the full scan the lease manager does every second
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        pthread_mutex_lock(&mutex);
+        sink_value += expire_leases(0);
+        pthread_mutex_unlock(&mutex);
+    }
+}
+
+// One full DISCOVER -> OFFER -> REQUEST -> ACK exchange for a new client,
+// released again afterwards so the utilization stays where fill_pool left it
+void kernel_dora(void *arg, uint64_t iterations)
+{
+    static uint32_t next_id = 1u << 24;
+    DHCPMessage msg;
+    size_t len;
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        uint32_t id = next_id++;
+
+        make_request(&msg, &len, DHCPDISCOVER, id, 0, 0);
+        process_dhcp_message(&null_sink, &msg, len, &client_addr);
+        uint32_t offered = last_yiaddr;
+        make_request(&msg, &len, DHCPREQUEST, id, offered, 0);
+        process_dhcp_message(&null_sink, &msg, len, &client_addr);
+        make_request(&msg, &len, DHCPRELEASE, id, 0, 0);
+        msg.yiaddr = offered;
+        process_dhcp_message(&null_sink, &msg, len, &client_addr);
+    }
+}
+
+void kernel_renew(void *arg, uint64_t iterations)
+{
+    AddressPool *pool = arg;
+    uint32_t bound = pool->active;
+    DHCPMessage msg;
+    size_t len;
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        uint32_t id = (uint32_t)(i * 2654435761u) % bound;
+        uint32_t ip = htonl(ntohl(pool->range_start.s_addr) + id);
+        make_request(&msg, &len, DHCPREQUEST, id, 0, ip);
+        process_dhcp_message(&null_sink, &msg, len, &client_addr);
+    }
+}
+
+double cpu_time(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Binds a server socket on an ephemeral loopback port
+int loopback_socket(struct sockaddr_in *addr)
+{
+    socklen_t len = sizeof(*addr);
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(sockfd, (struct sockaddr *)addr, sizeof(*addr));
+    getsockname(sockfd, (struct sockaddr *)addr, &len);
+    return sockfd;
+}
+
+void *run_uring(void *arg)
+{
+    uring_engine_run(arg);
+    return NULL;
+}
+
+// Drives renewals at a server engine over loopback from this thread and
+// reports both throughput and the CPU the server threads spent per message
+// (process CPU minus this thread's CPU)
+void loopback_run(const char *name, struct sockaddr_in *server, AddressPool *pool)
+{
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct pollfd pfd = {sockfd, POLLIN, 0};
+    uint32_t bound = pool->active;
+    DHCPMessage msg;
+    char buffer[1024];
+    size_t len;
+    uint64_t sent = 0, received = 0;
+
+    double wall = now();
+    double process_cpu = cpu_time(CLOCK_PROCESS_CPUTIME_ID);
+    double client_cpu = cpu_time(CLOCK_THREAD_CPUTIME_ID);
+    while (received < LOOPBACK_MESSAGES)
+    {
+        while (sent < LOOPBACK_MESSAGES && sent - received < LOOPBACK_WINDOW)
+        {
+            uint32_t id = (uint32_t)(sent * 2654435761u) % bound;
+            uint32_t ip = htonl(ntohl(pool->range_start.s_addr) + id);
+            make_request(&msg, &len, DHCPREQUEST, id, 0, ip);
+            sendto(sockfd, &msg, len, 0, (struct sockaddr *)server, sizeof(*server));
+            sent++;
+        }
+        if (poll(&pfd, 1, 1000) <= 0)
+            break; // Lost replies, report what we have
+        while (recv(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+            received++;
+    }
+    client_cpu = cpu_time(CLOCK_THREAD_CPUTIME_ID) - client_cpu;
+    process_cpu = cpu_time(CLOCK_PROCESS_CPUTIME_ID) - process_cpu;
+    wall = now() - wall;
+    close(sockfd);
+
+    double server_ns = received ? (process_cpu - client_cpu) * 1e9 / received : 0;
+    printf("%s\n    {\"name\": \"%s\", \"table_size\": %u, \"iterations\": %lu, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f, \"server_cpu_ns_per_op\": %.2f}",
+           result_count++ ? "," : "", name, pool_size(pool), received,
+           received ? wall * 1e9 / received : 0, received / wall, server_ns);
+    fflush(stdout);
+}
+
+// Streams the whole table through a bulk leasequery over loopback TCP and
+// reports bindings delivered per second, best of RUNS dumps
+void bulk_leasequery_run(const char *name, AddressPool *pool)
+{
+    int port = leasequery_start(0);
+    if (port < 0)
+        return;
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sin_port = htons(port);
+
+    DHCPMessage query;
+    size_t len;
+    make_request(&query, &len, DHCPBULKLEASEQUERY, 0, 0, 0);
+    memset(query.chaddr, 0, 16); // Every binding
+    uint8_t frame[2 + sizeof(DHCPMessage)];
+    frame[0] = len >> 8;
+    frame[1] = len & 0xff;
+    memcpy(frame + 2, &query, len);
+
+    size_t capacity = 256 * 1024;
+    uint8_t *buffer = malloc(capacity);
+    uint64_t rows = 0;
+    double best = 1e30;
+    for (int run = 0; run < RUNS; run++)
+    {
+        int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(sockfd, (struct sockaddr *)&server, sizeof(server)) < 0)
+        {
+            close(sockfd);
+            break;
+        }
+        double start = now();
+        send(sockfd, frame, 2 + len, 0);
+
+        // Walk the length-prefixed frames until DHCPLEASEQUERYDONE
+        size_t used = 0;
+        int done = 0;
+        rows = 0;
+        while (!done)
+        {
+            ssize_t n = recv(sockfd, buffer + used, capacity - used, 0);
+            if (n <= 0)
+                break;
+            used += n;
+            size_t offset = 0;
+            while (used - offset >= 2)
+            {
+                size_t frame_len = buffer[offset] << 8 | buffer[offset + 1];
+                if (used - offset < 2 + frame_len)
+                    break;
+                DHCPMessage *reply = (DHCPMessage *)(buffer + offset + 2);
+                DHCPOptions opts;
+                if (dhcp_index_options(reply, frame_len, &opts))
+                {
+                    rows += opts.message_type == DHCPLEASEACTIVE;
+                    done |= opts.message_type != DHCPLEASEACTIVE;
+                }
+                offset += 2 + frame_len;
+            }
+            memmove(buffer, buffer + offset, used - offset);
+            used -= offset;
+        }
+        double elapsed = now() - start;
+        close(sockfd);
+        if (elapsed < best)
+            best = elapsed;
+    }
+    free(buffer);
+
+    printf("%s\n    {\"name\": \"%s\", \"table_size\": %u, \"iterations\": %lu, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f}",
+           result_count++ ? "," : "", name, pool_size(pool), rows,
+           rows ? best * 1e9 / rows : 0, rows ? rows / best : 0);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *label = argc > 1 ? argv[1] : "";
+
+    quiet = 1;
+    subnet_mask.s_addr = htonl(0xff000000);     // 255.0.0.0
+    default_gateway.s_addr = htonl(0x0a000001); // 10.0.0.1
+    client_addr.sin_family = AF_INET;
+    client_addr.sin_port = htons(68);
+    client_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    printf("{\n  \"label\": \"%s\",\n  \"results\": [", label);
+
+    make_request(&request, &request_len, DHCPREQUEST, 1, htonl(0x0a000002), 0);
+    reset_pool(256);
+    report("parse_options", 0, kernel_parse_options, &request);
+    report("encode_reply_template", 0, kernel_encode_template, &request);
+    report("encode_reply_options", 0, kernel_encode_options, NULL);
+
+    for (size_t t = 0; t < sizeof(table_sizes) / sizeof(table_sizes[0]); t++)
+    {
+        uint32_t size = table_sizes[t];
+        AddressPool *pool = reset_pool(size);
+        fill_pool(pool, size / 2);
+
+        report("allocate_half_full", size, kernel_allocate, pool);
+        report("lookup_ip", size, kernel_lookup_ip, pool);
+        report("lookup_mac", size, kernel_lookup_mac, pool);
+        report("expire_sweep", size, kernel_expire_sweep, pool);
+        report("dora_exchange", size, kernel_dora, pool);
+        report("renew", size, kernel_renew, pool);
+    }
+
+    // Full table dump over the leasequery TCP listener
+    AddressPool *pool = reset_pool(MAX_LEASES);
+    fill_pool(pool, MAX_LEASES);
+    bulk_leasequery_run("bulk_leasequery", pool);
+
+    // Renewals with tracing at a production sampling rate, the untraced
+    // transactions should only pay for the sampling check
+    const char *trace_path = "/tmp/dhcp-bench.dtr";
+    if (trace_start(trace_path, "bench", 64) == 0)
+    {
+        pool = reset_pool(4096);
+        fill_pool(pool, 2048);
+        report("renew_traced", 4096, kernel_renew, pool);
+        trace_stop();
+        unlink(trace_path);
+    }
+
+    // Renewals again with the event stream on and a subscriber that never
+    // reads, so every event ends up dropped on its buffer: the packet path
+    // cost should stay at the queue push
+    const char *events_path = "/tmp/dhcp-bench-events.sock";
+    if (events_start(events_path) == 0)
+    {
+        struct sockaddr_un events_addr;
+        memset(&events_addr, 0, sizeof(events_addr));
+        events_addr.sun_family = AF_UNIX;
+        strcpy(events_addr.sun_path, events_path);
+        int subscriber = socket(AF_UNIX, SOCK_STREAM, 0);
+        connect(subscriber, (struct sockaddr *)&events_addr, sizeof(events_addr));
+
+        pool = reset_pool(4096);
+        fill_pool(pool, 2048);
+        report("renew_with_events", 4096, kernel_renew, pool);
+        close(subscriber);
+        unlink(events_path);
+    }
+
+    // Classification cost as the rule set grows, should stay flat
+    const char *classes_path = "/tmp/dhcp-bench-classes.conf";
+    const int class_counts[] = {16, 256, 1000};
+    for (size_t i = 0; i < sizeof(class_counts) / sizeof(class_counts[0]); i++)
+    {
+        if (write_classes(classes_path, class_counts[i]) == 0 && classes_load(classes_path) == 0)
+            report("classify", class_counts[i], kernel_classify, &request);
+    }
+    unlink(classes_path);
+    class_count = 0; // Default options again for the loopback runs
+
+    // Same renewal load through each I/O engine over loopback. Last, since
+    // the worker threads and the io_uring engine are never stopped and the
+    // engine keeps sweeping the table every second
+    pool = reset_pool(256);
+    fill_pool(pool, 128);
+    struct sockaddr_in server;
+    static int threads_sockfd;
+    threads_sockfd = loopback_socket(&server);
+    pthread_t tid;
+    for (int i = 0; i < 3; i++)
+        pthread_create(&tid, NULL, handle_client, &threads_sockfd);
+    loopback_run("loopback_threads", &server, pool);
+    struct sockaddr_in threads_server = server;
+
+    int uring_sockfd = loopback_socket(&server);
+    UringEngine *engine = uring_engine_create(uring_sockfd);
+    if (engine)
+    {
+        pthread_create(&tid, NULL, run_uring, engine);
+        loopback_run("loopback_uring", &server, pool);
+    }
+
+    // Renewals forwarded through the relay to the threaded server
+    RelayConfig relay_config;
+    memset(&relay_config, 0, sizeof(relay_config));
+    relay_config.listen_ip.s_addr = htonl(INADDR_LOOPBACK);
+    relay_config.giaddr.s_addr = htonl(INADDR_LOOPBACK);
+    relay_config.threads = 2;
+    relay_config.quiet = 1;
+    relay_config.servers[0] = threads_server;
+    relay_config.server_count = 1;
+    Relay *relay = relay_start(&relay_config);
+    if (relay)
+    {
+        struct sockaddr_in relay_addr = relay_address(relay);
+        loopback_run("relay_loopback", &relay_addr, pool);
+    }
+
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <time.h>
+#include "dhcp.h"
+
+#define DHCP_SERVER_PORT 67 // RFC 6926 leasequery runs on the DHCP port over TCP
+#define STREAM_BUFFER (256 * 1024)
+
+// Bulk leasequery (RFC 6926) consumer: sends one DHCPBULKLEASEQUERY over TCP
+// and prints the DHCPLEASEACTIVE rows streamed back until DHCPLEASEQUERYDONE.
+
+typedef struct
+{
+    int sockfd;
+    uint8_t *data;
+    size_t start;
+    size_t end;
+} Stream;
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns the next length-prefixed message, NULL once the server hangs up
+DHCPMessage *next_message(Stream *stream, size_t *len)
+{
+    while (1)
+    {
+        size_t avail = stream->end - stream->start;
+        if (avail >= 2)
+        {
+            uint8_t *frame = stream->data + stream->start;
+            size_t frame_len = frame[0] << 8 | frame[1];
+            if (avail >= 2 + frame_len)
+            {
+                stream->start += 2 + frame_len;
+                *len = frame_len;
+                return (DHCPMessage *)(frame + 2);
+            }
+        }
+
+        // Keep the partial frame and refill behind it
+        memmove(stream->data, stream->data + stream->start, avail);
+        stream->start = 0;
+        stream->end = avail;
+        ssize_t n = recv(stream->sockfd, stream->data + stream->end, STREAM_BUFFER - stream->end, 0);
+        if (n <= 0)
+            return NULL;
+        stream->end += n;
+    }
+}
+
+int parse_mac(const char *text, uint8_t *chaddr)
+{
+    unsigned int b[6];
+    if (sscanf(text, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6)
+        return -1;
+    for (int i = 0; i < 6; i++)
+        chaddr[i] = b[i];
+    return 0;
+}
+
+uint32_t option32(DHCPMessage *msg, DHCPOptions *opts, uint8_t code)
+{
+    uint8_t len;
+    uint8_t *data = dhcp_get_option(msg, opts, code, &len);
+    uint32_t value = 0;
+    if (data && len == 4)
+        memcpy(&value, data, 4);
+    return ntohl(value);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = NULL;
+    int port = DHCP_SERVER_PORT;
+    int print_rows = 1;
+    int usage_error = 0;
+    DHCPMessage query;
+    memset(&query, 0, sizeof(query));
+    uint8_t relay_id[4];
+    int by_relay = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--mac") == 0 && i + 1 < argc)
+            usage_error |= parse_mac(argv[++i], query.chaddr) < 0;
+        else if (strcmp(argv[i], "--range") == 0 && i + 1 < argc)
+        {
+            char start[32];
+            const char *end = strchr(argv[++i], '-');
+            size_t start_len = end ? (size_t)(end - argv[i]) : strlen(argv[i]);
+            if (start_len >= sizeof(start))
+            {
+                usage_error = 1;
+                continue;
+            }
+            memcpy(start, argv[i], start_len);
+            start[start_len] = '\0';
+            usage_error |= inet_pton(AF_INET, start, &query.ciaddr) != 1;
+            if (end)
+                usage_error |= inet_pton(AF_INET, end + 1, &query.yiaddr) != 1;
+        }
+        else if (strcmp(argv[i], "--relay") == 0 && i + 1 < argc)
+        {
+            usage_error |= inet_pton(AF_INET, argv[++i], relay_id) != 1;
+            by_relay = 1;
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+            print_rows = 0;
+        else if (argv[i][0] != '-' && !host)
+            host = argv[i];
+        else if (argv[i][0] != '-' && port == DHCP_SERVER_PORT)
+            port = atoi(argv[i]);
+        else
+            usage_error = 1;
+    }
+    if (!host || usage_error)
+    {
+        fprintf(stderr, "Usage: %s [--mac MAC] [--range IP[-IP]] [--relay IP] [-q] server_ip [port]\n", argv[0]);
+        exit(1);
+    }
+
+    // The query itself: a BOOTREQUEST whose header fields are the filters
+    srand(time(NULL));
+    query.op = 1;
+    query.htype = 1;
+    query.hlen = 6;
+    query.xid = rand();
+    uint8_t *p = query.options;
+    *p++ = 0x63; // Magic cookie
+    *p++ = 0x82;
+    *p++ = 0x53;
+    *p++ = 0x63;
+    *p++ = 53;
+    *p++ = 1;
+    *p++ = DHCPBULKLEASEQUERY;
+    if (by_relay)
+    {
+        *p++ = 82; // Relay Agent Information holding only a Relay-ID
+        *p++ = 6;
+        *p++ = 12;
+        *p++ = 4;
+        memcpy(p, relay_id, 4);
+        p += 4;
+    }
+    *p++ = 255;
+    uint16_t query_len = DHCP_HEADER_SIZE + (p - query.options);
+
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0)
+    {
+        perror("Error creating socket");
+        exit(1);
+    }
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &server_addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "Error: invalid server address %s\n", host);
+        exit(1);
+    }
+    if (connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        perror("Error connecting to server");
+        exit(1);
+    }
+
+    uint8_t frame[2 + sizeof(DHCPMessage)];
+    frame[0] = query_len >> 8;
+    frame[1] = query_len & 0xff;
+    memcpy(frame + 2, &query, query_len);
+    double start = now();
+    if (send(sockfd, frame, 2 + query_len, 0) < 0)
+    {
+        perror("Error sending query");
+        exit(1);
+    }
+
+    Stream stream = {sockfd, malloc(STREAM_BUFFER), 0, 0};
+    size_t rows = 0;
+    int done = 0;
+    size_t len;
+    DHCPMessage *msg;
+    while (!done && (msg = next_message(&stream, &len)))
+    {
+        DHCPOptions opts;
+        if (msg->xid != query.xid || !dhcp_index_options(msg, len, &opts))
+            continue;
+
+        switch (opts.message_type)
+        {
+        case DHCPLEASEACTIVE:
+            rows++;
+            if (print_rows)
+            {
+                struct in_addr ip = {msg->ciaddr};
+                struct in_addr relay = {msg->giaddr};
+                char ip_text[INET_ADDRSTRLEN];
+                inet_ntop(AF_INET, &ip, ip_text, sizeof(ip_text));
+                printf("IP: %s, MAC: %02x:%02x:%02x:%02x:%02x:%02x, Remaining: %us, Age: %us, Relay: %s\n", ip_text,
+                       msg->chaddr[0], msg->chaddr[1], msg->chaddr[2], msg->chaddr[3], msg->chaddr[4], msg->chaddr[5],
+                       option32(msg, &opts, 51), option32(msg, &opts, 91), relay.s_addr ? inet_ntoa(relay) : "-");
+            }
+            break;
+        case DHCPLEASEQUERYDONE:
+            done = 1;
+            break;
+        case DHCPLEASEQUERYSTATUS:
+        {
+            uint8_t status_len;
+            uint8_t *status = dhcp_get_option(msg, &opts, 151, &status_len);
+            fprintf(stderr, "Query refused, status %d\n", status && status_len ? status[0] : -1);
+            exit(2);
+        }
+        }
+    }
+    double elapsed = now() - start;
+    if (!done)
+    {
+        fprintf(stderr, "Connection closed before DHCPLEASEQUERYDONE\n");
+        exit(2);
+    }
+
+    printf("%zu bindings in %.3f s (%.0f rows/s)\n", rows, elapsed, elapsed > 0 ? rows / elapsed : 0.0);
+    close(sockfd);
+    free(stream.data);
+    return 0;
+}
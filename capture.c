@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "capture.h"
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_MAX_SNAPLEN 262144
+#define REPLY_WINDOW 5.0  // Seconds a recorded reply may trail its request
+#define MAX_PRINTED_DIFFS 10
+
+// Link layer types we know how to strip
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_LINUX_SLL2 276
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} PcapFileHeader;
+
+typedef struct
+{
+    uint32_t ts_sec;
+    uint32_t ts_frac; // Microseconds, or nanoseconds with PCAP_MAGIC_NSEC
+    uint32_t caplen;
+    uint32_t len;
+} PcapRecordHeader;
+
+uint32_t swap32(uint32_t value)
+{
+    return __builtin_bswap32(value);
+}
+
+// Returns the offset of the IPv4 header inside a frame, -1 if there is none
+long ip_offset(uint32_t linktype, uint8_t *frame, size_t len)
+{
+    size_t offset;
+    uint16_t ethertype;
+
+    switch (linktype)
+    {
+    case LINKTYPE_NULL:
+        return len >= 4 ? 4 : -1;
+    case LINKTYPE_RAW:
+    case LINKTYPE_IPV4:
+        return 0;
+    case LINKTYPE_ETHERNET:
+        offset = 12;
+        break;
+    case LINKTYPE_LINUX_SLL:
+        offset = 14;
+        break;
+    case LINKTYPE_LINUX_SLL2:
+        if (len < 20)
+            return -1;
+        return frame[0] == 0x08 && frame[1] == 0x00 ? 20 : -1;
+    default:
+        return -1;
+    }
+
+    // Skip any 802.1Q / 802.1ad tags
+    while (offset + 2 <= len)
+    {
+        ethertype = (frame[offset] << 8) | frame[offset + 1];
+        if (ethertype == 0x8100 || ethertype == 0x88a8)
+        {
+            offset += 4;
+            continue;
+        }
+        return ethertype == 0x0800 ? (long)(offset + 2) : -1;
+    }
+    return -1;
+}
+
+// Appends the UDP/67 DHCP payload of a frame to the trace, returns 0 if skipped
+int add_frame(ReplayTrace *trace, uint32_t linktype, uint8_t *frame, size_t len, double timestamp,
+              uint32_t sequence, size_t *request_capacity, size_t *reply_capacity)
+{
+    long offset = ip_offset(linktype, frame, len);
+    if (offset < 0 || (size_t)offset + 20 > len)
+        return 0;
+
+    uint8_t *ip = frame + offset;
+    size_t ip_len = len - offset;
+    size_t header_len = (ip[0] & 0x0f) * 4;
+    uint16_t fragment = (ip[6] << 8) | ip[7];
+    if ((ip[0] >> 4) != 4 || ip[9] != 17 || header_len < 20 || header_len + 8 > ip_len)
+        return 0;
+    if (fragment & 0x3fff) // More fragments or non zero offset
+        return 0;
+
+    uint8_t *udp = ip + header_len;
+    uint16_t source_port = (udp[0] << 8) | udp[1];
+    uint16_t dest_port = (udp[2] << 8) | udp[3];
+    uint16_t udp_len = (udp[4] << 8) | udp[5];
+    if (source_port != 67 && dest_port != 67)
+        return 0;
+
+    size_t payload_len = ip_len - header_len - 8;
+    if (udp_len >= 8 && udp_len - 8u < payload_len)
+        payload_len = udp_len - 8;
+    if (payload_len < DHCP_MIN_SIZE)
+        return 0;
+    if (payload_len > sizeof(DHCPMessage))
+        payload_len = sizeof(DHCPMessage);
+
+    DHCPMessage *msg;
+    if (udp[8] == 1 && dest_port == 67) // BOOTREQUEST to a server
+    {
+        if (trace->request_count == *request_capacity)
+        {
+            *request_capacity = *request_capacity ? *request_capacity * 2 : 1024;
+            trace->requests = realloc(trace->requests, *request_capacity * sizeof(CapturedRequest));
+        }
+        CapturedRequest *request = &trace->requests[trace->request_count++];
+        memset(request, 0, sizeof(*request));
+        request->timestamp = timestamp;
+        request->sequence = sequence;
+        request->source.sin_family = AF_INET;
+        memcpy(&request->source.sin_addr, ip + 12, 4);
+        request->source.sin_port = htons(source_port);
+        request->length = payload_len;
+        request->reply = -1;
+        msg = &request->msg;
+    }
+    else if (udp[8] == 2 && source_port == 67) // BOOTREPLY from a server
+    {
+        if (trace->reply_count == *reply_capacity)
+        {
+            *reply_capacity = *reply_capacity ? *reply_capacity * 2 : 1024;
+            trace->replies = realloc(trace->replies, *reply_capacity * sizeof(CapturedReply));
+        }
+        CapturedReply *reply = &trace->replies[trace->reply_count++];
+        memset(reply, 0, sizeof(*reply));
+        reply->timestamp = timestamp;
+        reply->sequence = sequence;
+        reply->length = payload_len;
+        msg = &reply->msg;
+    }
+    else
+    {
+        return 0;
+    }
+    memcpy(msg, udp + 8, payload_len);
+    return 1;
+}
+
+// Pairs every request with the first unclaimed reply for the same xid and
+// chaddr that follows it in the capture
+void match_replies(ReplayTrace *trace)
+{
+    char *claimed = calloc(trace->reply_count + 1, 1);
+    size_t first = 0;
+
+    for (size_t i = 0; i < trace->request_count; i++)
+    {
+        CapturedRequest *request = &trace->requests[i];
+        while (first < trace->reply_count && trace->replies[first].sequence < request->sequence)
+            first++;
+        for (size_t j = first; j < trace->reply_count; j++)
+        {
+            CapturedReply *reply = &trace->replies[j];
+            if (reply->timestamp > request->timestamp + REPLY_WINDOW)
+                break;
+            if (!claimed[j] && reply->msg.xid == request->msg.xid && memcmp(reply->msg.chaddr, request->msg.chaddr, 16) == 0)
+            {
+                claimed[j] = 1;
+                request->reply = j;
+                break;
+            }
+        }
+    }
+    free(claimed);
+}
+
+int capture_load(const char *path, ReplayTrace *trace)
+{
+    memset(trace, 0, sizeof(*trace));
+
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        perror("Error opening capture");
+        return -1;
+    }
+
+    PcapFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1)
+    {
+        fprintf(stderr, "Error: %s is too short to be a pcap file\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    int swapped = 0;
+    int nanosecond = 0;
+    if (header.magic == swap32(PCAP_MAGIC) || header.magic == swap32(PCAP_MAGIC_NSEC))
+    {
+        swapped = 1;
+        header.magic = swap32(header.magic);
+        header.linktype = swap32(header.linktype);
+    }
+    if (header.magic == PCAP_MAGIC_NSEC)
+        nanosecond = 1;
+    else if (header.magic != PCAP_MAGIC)
+    {
+        fprintf(stderr, "Error: %s is not a classic pcap file (pcapng is not supported)\n", path);
+        fclose(file);
+        return -1;
+    }
+    header.linktype &= 0xffff; // Upper bits carry FCS information
+
+    uint8_t *frame = malloc(PCAP_MAX_SNAPLEN);
+    size_t request_capacity = 0, reply_capacity = 0;
+    uint32_t sequence = 0;
+    double first_timestamp = -1.0;
+    PcapRecordHeader record;
+
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        if (swapped)
+        {
+            record.ts_sec = swap32(record.ts_sec);
+            record.ts_frac = swap32(record.ts_frac);
+            record.caplen = swap32(record.caplen);
+        }
+        if (record.caplen > PCAP_MAX_SNAPLEN || fread(frame, 1, record.caplen, file) != record.caplen)
+        {
+            fprintf(stderr, "Warning: truncated capture, stopping after %u packets\n", sequence);
+            break;
+        }
+
+        double timestamp = record.ts_sec + record.ts_frac / (nanosecond ? 1e9 : 1e6);
+        if (add_frame(trace, header.linktype, frame, record.caplen, timestamp, sequence, &request_capacity, &reply_capacity))
+        {
+            if (first_timestamp < 0)
+                first_timestamp = timestamp;
+        }
+        else
+        {
+            trace->packets_skipped++;
+        }
+        sequence++;
+    }
+    free(frame);
+    fclose(file);
+
+    // Make timestamps relative to the first DHCP packet
+    for (size_t i = 0; i < trace->request_count; i++)
+        trace->requests[i].timestamp -= first_timestamp;
+    for (size_t i = 0; i < trace->reply_count; i++)
+        trace->replies[i].timestamp -= first_timestamp;
+
+    match_replies(trace);
+    printf("Loaded %zu requests and %zu recorded replies from %s (%lu packets skipped)\n",
+           trace->request_count, trace->reply_count, path, trace->packets_skipped);
+    return 0;
+}
+
+void capture_free(ReplayTrace *trace)
+{
+    free(trace->requests);
+    free(trace->replies);
+    memset(trace, 0, sizeof(*trace));
+}
+
+void print_diff(ReplayStats *stats, CapturedRequest *request, const char *what)
+{
+    uint64_t diffs = stats->mismatched + stats->missing + stats->unexpected;
+    if (diffs > MAX_PRINTED_DIFFS)
+        return;
+    if (diffs == MAX_PRINTED_DIFFS)
+    {
+        printf("(further differences omitted)\n");
+        return;
+    }
+    printf("Packet %u, xid 0x%08x %02x:%02x:%02x:%02x:%02x:%02x: %s\n",
+           request->sequence, ntohl(request->msg.xid),
+           request->msg.chaddr[0], request->msg.chaddr[1], request->msg.chaddr[2],
+           request->msg.chaddr[3], request->msg.chaddr[4], request->msg.chaddr[5], what);
+}
+
+void capture_check_reply(ReplayTrace *trace, ReplayStats *stats, size_t index, DHCPMessage *reply, size_t len)
+{
+    CapturedRequest *request = &trace->requests[index];
+    stats->replies++;
+    if (request->reply >= 0)
+        stats->expected++;
+
+    if (request->reply < 0)
+    {
+        print_diff(stats, request, "reply sent where none was recorded");
+        stats->unexpected++;
+        return;
+    }
+
+    // Lease times are left out on purpose, they depend on pool utilization
+    // and jitter rather than on the request itself
+    CapturedReply *recorded = &trace->replies[request->reply];
+    DHCPOptions recorded_opts, actual_opts;
+    dhcp_index_options(&recorded->msg, recorded->length, &recorded_opts);
+    dhcp_index_options(reply, len, &actual_opts);
+
+    char what[128];
+    what[0] = '\0';
+    if (recorded_opts.message_type != actual_opts.message_type)
+    {
+        snprintf(what, sizeof(what), "message type %u, recorded %u",
+                 actual_opts.message_type, recorded_opts.message_type);
+    }
+    else if (recorded->msg.yiaddr != reply->yiaddr)
+    {
+        struct in_addr actual_ip = {reply->yiaddr};
+        struct in_addr recorded_ip = {recorded->msg.yiaddr};
+        char actual_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &actual_ip, actual_str, sizeof(actual_str));
+        snprintf(what, sizeof(what), "yiaddr %s, recorded %s", actual_str, inet_ntoa(recorded_ip));
+    }
+
+    if (what[0])
+    {
+        print_diff(stats, request, what);
+        stats->mismatched++;
+    }
+    else
+    {
+        stats->matched++;
+    }
+}
+
+void capture_check_no_reply(ReplayTrace *trace, ReplayStats *stats, size_t index)
+{
+    CapturedRequest *request = &trace->requests[index];
+    if (request->reply < 0)
+        return;
+    stats->expected++;
+    print_diff(stats, request, "no reply, one was recorded");
+    stats->missing++;
+}
+
+void capture_print_report(ReplayStats *stats)
+{
+    printf("\n--- Replay Report ---\n");
+    printf("Messages: %lu in %.3f seconds (%.0f messages/s)\n", stats->messages, stats->elapsed,
+           stats->elapsed > 0 ? stats->messages / stats->elapsed : 0.0);
+    printf("Replies: %lu sent, %lu recorded\n", stats->replies, stats->expected);
+    printf("Matched: %lu, mismatched: %lu, missing: %lu, unexpected: %lu\n",
+           stats->matched, stats->mismatched, stats->missing, stats->unexpected);
+    printf("---------------------\n");
+}
@@ -0,0 +1,64 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <netinet/in.h>
+#include "dhcp.h"
+
+// DHCP messages pulled out of a classic pcap capture, so that production
+// traffic can be fed back into the server and the replies compared against
+// what was recorded at the time.
+
+typedef struct
+{
+    double timestamp;          // Seconds since the first DHCP packet in the capture
+    uint32_t sequence;         // Position in the capture
+    struct sockaddr_in source; // Client (or relay) the message came from
+    DHCPMessage msg;
+    size_t length;
+    long reply; // Index of the recorded reply in replies[], -1 if none
+} CapturedRequest;
+
+typedef struct
+{
+    double timestamp;
+    uint32_t sequence;
+    DHCPMessage msg;
+    size_t length;
+} CapturedReply;
+
+typedef struct
+{
+    CapturedRequest *requests;
+    size_t request_count;
+    CapturedReply *replies;
+    size_t reply_count;
+    uint64_t packets_skipped; // Non DHCP, fragmented or non IPv4 frames
+} ReplayTrace;
+
+typedef struct
+{
+    uint64_t messages;   // Requests fed to the server
+    uint64_t replies;    // Replies the server produced
+    uint64_t expected;   // Requests that had a recorded reply
+    uint64_t matched;    // Replies equal to the recorded one
+    uint64_t mismatched; // Replies that differ from the recorded one
+    uint64_t missing;    // Recorded replies the server did not produce
+    uint64_t unexpected; // Replies produced where none was recorded
+    double elapsed;      // Seconds spent replaying
+} ReplayStats;
+
+// Loads every UDP port 67 DHCP message of a pcap file, returns -1 on error
+int capture_load(const char *path, ReplayTrace *trace);
+void capture_free(ReplayTrace *trace);
+
+// Checks a reply produced for requests[index] against the recorded one and
+// updates the stats, printing the first few differences
+void capture_check_reply(ReplayTrace *trace, ReplayStats *stats, size_t index, DHCPMessage *reply, size_t len);
+
+// Accounts for requests[index] having produced no reply at all
+void capture_check_no_reply(ReplayTrace *trace, ReplayStats *stats, size_t index);
+
+void capture_print_report(ReplayStats *stats);
+
+#endif
@@ -0,0 +1,675 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <arpa/inet.h>
+#include "server.h"
+
+// Client classes, one per line of the --classes file, in priority order:
+//
+//   class voip vendor=Polycom pool=192.17.1.10-192.17.1.200 router=192.17.1.1 lease=600-7200
+//   class pxe vendor=PXEClient option=66:tftp.lab option=67:pxelinux.0
+//   class cams oui=00:11:22 dns=10.0.0.53,10.0.0.54
+//   class lab circuit=eth0/1 remote="switch 3" domain=lab.example
+//
+// A class matches when all of its criteria do: vendor is a prefix of option
+// 60, user equals option 77, circuit and remote equal sub-options 1 and 2 of
+// option 82 and oui the first three bytes of chaddr. The first class that
+// matches picks the reply template and, with pool=, the addresses; clients
+// matching none get the default options from the shared pools.
+//
+// The rules are compiled at load time so the per-packet cost does not grow
+// with the number of classes. Each criterion turns the packet's value into a
+// small id in one pass over its bytes: a DFA over the bytes the vendor
+// prefixes use, keeping the longest match, and hash tables for the exact
+// values. The ids then index a decision diagram with one level per criterion
+// and the winning class at the leaves. Levels a subtree does not depend on
+// are skipped, and while building it the classes behind one that nothing
+// further down can reject are dropped, since they can no longer win.
+
+#define MAX_CLASSES 1024
+#define CLASS_WORDS (MAX_CLASSES / 64)
+#define CLASS_VALUE_MAX 64
+#define CLASS_CRITERIA 5
+#define CRITERION_VENDOR 0
+#define CRITERION_USER 1
+#define CRITERION_CIRCUIT 2
+#define CRITERION_REMOTE 3
+#define CRITERION_OUI 4
+#define CLASS_BASE_LEN 43      // set_reply_options up to END: 53, 51, 58, 59, mask, DNS, router
+#define CLASS_OPTIONS_MAX 286  // options[] minus the cookie, 53, 51, 58, 59 and END
+#define EXACT_BUCKETS 2048     // Power of two, at least twice MAX_CLASSES
+#define DECISION_MAX (1 << 22) // Table entries before giving up on a rule set
+#define MEMO_BUCKETS 65536     // Power of two
+
+typedef struct
+{
+    uint64_t bits[CLASS_WORDS];
+} ClassSet;
+
+typedef struct
+{
+    uint8_t data[CLASS_VALUE_MAX];
+    uint8_t len;
+} ClassValue;
+
+// Subtrees already built, shared by every path that reaches the same set
+typedef struct MemoEntry
+{
+    int level;
+    ClassSet set;
+    int32_t node;
+    struct MemoEntry *next;
+} MemoEntry;
+
+ClientClass classes[MAX_CLASSES];
+int class_count = 0;
+uint16_t class_criteria[MAX_CLASSES][CLASS_CRITERIA]; // Value id, 0 if unconstrained
+
+// Distinct values per criterion, ids from 1; 0 stands for no match
+ClassValue values[CLASS_CRITERIA][MAX_CLASSES + 1];
+int value_count[CLASS_CRITERIA];
+uint16_t exact_buckets[CLASS_CRITERIA][EXACT_BUCKETS];
+ClassSet compatible[CLASS_CRITERIA][MAX_CLASSES + 1]; // Classes a value id does not rule out
+
+// Vendor prefix DFA: state 0 is dead, 1 the start
+uint16_t byte_column[256]; // 0 for bytes no prefix uses, so up to 257 columns
+int dfa_columns = 1;
+uint32_t *dfa;
+uint16_t *dfa_accept; // Value id of the prefix ending at a state
+uint32_t dfa_states = 2;
+
+// Decision diagram: a node is its level followed by one child per value id.
+// Children >= 0 are nodes, leaves are -1 - class, class_count for none
+int32_t *decision;
+uint32_t decision_len = 0;
+int32_t decision_root;
+MemoEntry *memo[MEMO_BUCKETS];
+
+uint64_t default_matches = 0;
+
+uint32_t value_hash(const uint8_t *data, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ data[i]) * 16777619u; // FNV-1a
+    return hash;
+}
+
+uint16_t exact_lookup(int criterion, const uint8_t *data, size_t len)
+{
+    uint32_t bucket = value_hash(data, len) & (EXACT_BUCKETS - 1);
+    uint16_t id;
+    while ((id = exact_buckets[criterion][bucket]) != 0)
+    {
+        ClassValue *value = &values[criterion][id];
+        if (value->len == len && memcmp(value->data, data, len) == 0)
+            return id;
+        bucket = (bucket + 1) & (EXACT_BUCKETS - 1);
+    }
+    return 0;
+}
+
+uint16_t vendor_lookup(const uint8_t *data, size_t len)
+{
+    uint32_t state = 1;
+    uint16_t match = 0;
+    for (size_t i = 0; i < len && state; i++)
+    {
+        state = dfa[state * dfa_columns + byte_column[data[i]]];
+        if (dfa_accept[state])
+            match = dfa_accept[state];
+    }
+    return match;
+}
+
+// Id of a criterion value, registering it on first sight
+uint16_t intern_value(int criterion, const uint8_t *data, size_t len)
+{
+    for (int id = 1; id <= value_count[criterion]; id++)
+    {
+        if (values[criterion][id].len == len && memcmp(values[criterion][id].data, data, len) == 0)
+            return id;
+    }
+    uint16_t id = ++value_count[criterion];
+    memcpy(values[criterion][id].data, data, len);
+    values[criterion][id].len = len;
+    if (criterion != CRITERION_VENDOR)
+    {
+        uint32_t bucket = value_hash(data, len) & (EXACT_BUCKETS - 1);
+        while (exact_buckets[criterion][bucket])
+            bucket = (bucket + 1) & (EXACT_BUCKETS - 1);
+        exact_buckets[criterion][bucket] = id;
+    }
+    return id;
+}
+
+void build_vendor_dfa()
+{
+    int columns = 1, bytes = 0;
+    for (int id = 1; id <= value_count[CRITERION_VENDOR]; id++)
+    {
+        ClassValue *value = &values[CRITERION_VENDOR][id];
+        bytes += value->len;
+        for (int i = 0; i < value->len; i++)
+        {
+            if (!byte_column[value->data[i]])
+                byte_column[value->data[i]] = columns++;
+        }
+    }
+    dfa_columns = columns;
+    dfa = calloc((size_t)(bytes + 2) * columns, sizeof(uint32_t));
+    dfa_accept = calloc(bytes + 2, sizeof(uint16_t));
+    if (!dfa || !dfa_accept)
+        return; // classes_load reports it
+
+    // A trie is already deterministic; missing edges fall to the dead state
+    for (int id = 1; id <= value_count[CRITERION_VENDOR]; id++)
+    {
+        ClassValue *value = &values[CRITERION_VENDOR][id];
+        uint32_t state = 1;
+        for (int i = 0; i < value->len; i++)
+        {
+            uint32_t *next = &dfa[state * columns + byte_column[value->data[i]]];
+            if (!*next)
+                *next = dfa_states++;
+            state = *next;
+        }
+        dfa_accept[state] = id;
+    }
+}
+
+int value_is_prefix(ClassValue *prefix, ClassValue *value)
+{
+    return prefix->len <= value->len && memcmp(prefix->data, value->data, prefix->len) == 0;
+}
+
+void set_bit(ClassSet *set, int c)
+{
+    set->bits[c / 64] |= 1ull << (c % 64);
+}
+
+void build_compatible()
+{
+    for (int criterion = 0; criterion < CLASS_CRITERIA; criterion++)
+    {
+        for (int id = 0; id <= value_count[criterion]; id++)
+        {
+            ClassSet *set = &compatible[criterion][id];
+            for (int c = 0; c < class_count; c++)
+            {
+                uint16_t wanted = class_criteria[c][criterion];
+                if (!wanted || wanted == id ||
+                    (criterion == CRITERION_VENDOR && id &&
+                     value_is_prefix(&values[criterion][wanted], &values[criterion][id])))
+                    set_bit(set, c);
+            }
+        }
+    }
+}
+
+int first_class(ClassSet *set)
+{
+    for (int w = 0; w < CLASS_WORDS; w++)
+    {
+        if (set->bits[w])
+            return w * 64 + __builtin_ctzll(set->bits[w]);
+    }
+    return -1;
+}
+
+// Drops the classes behind the first one no level from here on can reject,
+// it wins over all of them. Returns that class, or -1
+int prune(ClassSet *set, int level)
+{
+    for (int c = 0; c < class_count; c++)
+    {
+        if (!(set->bits[c / 64] & (1ull << (c % 64))))
+            continue;
+        int settled = 1;
+        for (int l = level; l < CLASS_CRITERIA; l++)
+            settled &= class_criteria[c][l] == 0;
+        if (!settled)
+            continue;
+        set->bits[c / 64] &= (2ull << (c % 64)) - 1;
+        for (int w = c / 64 + 1; w < CLASS_WORDS; w++)
+            set->bits[w] = 0;
+        return c;
+    }
+    return -1;
+}
+
+int32_t build_node(int level, ClassSet *set)
+{
+    ClassSet pruned = *set;
+    int winner = prune(&pruned, level);
+    int first = first_class(&pruned);
+    if (first < 0)
+        return -1 - class_count;
+    if (first == winner) // Always the case past the last level
+        return -1 - first;
+
+    uint32_t bucket = value_hash((uint8_t *)&pruned, sizeof(pruned)) ^ level;
+    bucket &= MEMO_BUCKETS - 1;
+    for (MemoEntry *entry = memo[bucket]; entry; entry = entry->next)
+    {
+        if (entry->level == level && memcmp(&entry->set, &pruned, sizeof(pruned)) == 0)
+            return entry->node;
+    }
+
+    int width = value_count[level] + 1;
+    int32_t *children = malloc(width * sizeof(int32_t));
+    if (!children)
+        return INT32_MIN;
+    int same = 1;
+    int32_t node = INT32_MIN; // First child; if all are equal the level makes no difference here
+    for (int id = 0; id < width; id++)
+    {
+        ClassSet child;
+        for (int w = 0; w < CLASS_WORDS; w++)
+            child.bits[w] = pruned.bits[w] & compatible[level][id].bits[w];
+        children[id] = build_node(level + 1, &child);
+        if (children[id] == INT32_MIN)
+        {
+            free(children);
+            return INT32_MIN;
+        }
+        if (id == 0)
+            node = children[0];
+        same &= children[id] == node;
+    }
+
+    if (!same)
+    {
+        if (decision_len + 1 + width > DECISION_MAX)
+        {
+            free(children);
+            return INT32_MIN;
+        }
+        node = decision_len;
+        decision[decision_len++] = level;
+        memcpy(&decision[decision_len], children, width * sizeof(int32_t));
+        decision_len += width;
+    }
+    free(children);
+
+    MemoEntry *entry = malloc(sizeof(MemoEntry));
+    if (!entry)
+        return INT32_MIN;
+    entry->level = level;
+    entry->set = pruned;
+    entry->node = node;
+    entry->next = memo[bucket];
+    memo[bucket] = entry;
+    return node;
+}
+
+void free_memo()
+{
+    for (int i = 0; i < MEMO_BUCKETS; i++)
+    {
+        while (memo[i])
+        {
+            MemoEntry *next = memo[i]->next;
+            free(memo[i]);
+            memo[i] = next;
+        }
+    }
+}
+
+// Same layout as the shared pools' templates up to option 59 so build_reply
+// can patch the times, then the default mask, DNS and router the class did
+// not replace (bits 0 to 2 of defaults) and the class's own options
+size_t class_encode(uint8_t *options, uint8_t message_type, int defaults, uint8_t *extra, size_t extra_len)
+{
+    LeaseTimes times = {0, 0, 0};
+    uint8_t base[CLASS_BASE_LEN];
+    set_reply_options(options, message_type, &times);
+    memcpy(base, options, sizeof(base));
+    size_t at = 25;
+    for (int i = 0; i < 3; i++)
+    {
+        if (defaults & (1 << i))
+        {
+            memcpy(&options[at], &base[25 + 6 * i], 6);
+            at += 6;
+        }
+    }
+    if (at + extra_len + 1 > sizeof(((DHCPMessage *)0)->options))
+        return 0;
+    memcpy(&options[at], extra, extra_len);
+    at += extra_len;
+    options[at++] = 255;
+    memset(&options[at], 0, sizeof(((DHCPMessage *)0)->options) - at);
+    return at;
+}
+
+int append_option(uint8_t *extra, size_t *len, uint8_t code, const uint8_t *data, size_t data_len)
+{
+    if (data_len > 255 || *len + 2 + data_len > CLASS_OPTIONS_MAX)
+        return -1;
+    extra[(*len)++] = code;
+    extra[(*len)++] = data_len;
+    memcpy(&extra[*len], data, data_len);
+    *len += data_len;
+    return 0;
+}
+
+// Comma separated addresses, as option data
+int parse_addresses(const char *text, uint8_t *data, size_t *len)
+{
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", text);
+    *len = 0;
+    for (char *item = strtok(copy, ","); item; item = strtok(NULL, ","))
+    {
+        if (*len + 4 > 252 || inet_pton(AF_INET, item, &data[*len]) != 1)
+            return -1;
+        *len += 4;
+    }
+    return *len ? 0 : -1;
+}
+
+// "0x" followed by hex digits is raw bytes, anything else the text itself
+int parse_bytes(const char *text, uint8_t *data, size_t *len, size_t max)
+{
+    if (strncmp(text, "0x", 2) == 0)
+    {
+        const char *hex = text + 2;
+        size_t n = strlen(hex);
+        if (n % 2 || n / 2 > max)
+            return -1;
+        for (size_t i = 0; i < n / 2; i++)
+        {
+            unsigned int byte;
+            if (sscanf(&hex[i * 2], "%2x", &byte) != 1)
+                return -1;
+            data[i] = byte;
+        }
+        *len = n / 2;
+        return 0;
+    }
+    *len = strlen(text);
+    if (*len == 0 || *len > max)
+        return -1;
+    memcpy(data, text, *len);
+    return 0;
+}
+
+// Splits a line into whitespace separated tokens, double quotes keep spaces
+int tokenize(char *line, char **tokens, int max)
+{
+    int count = 0;
+    char *read = line, *write = line;
+    while (*read && count < max)
+    {
+        while (isspace((unsigned char)*read))
+            read++;
+        if (!*read || *read == '#')
+            break;
+        tokens[count++] = write;
+        int quoted = 0;
+        while (*read && (quoted || !isspace((unsigned char)*read)))
+        {
+            if (*read == '"')
+                quoted = !quoted;
+            else
+                *write++ = *read;
+            read++;
+        }
+        if (*read)
+            read++;
+        *write++ = '\0';
+    }
+    return count;
+}
+
+// A range find_pool would not shadow and the lease table still has room for
+int pool_range_free(struct in_addr start, struct in_addr end)
+{
+    uint32_t first = ntohl(start.s_addr), last = ntohl(end.s_addr);
+    if ((uint64_t)last - first + 1 > MAX_LEASES - lease_slots)
+        return 0;
+    for (int p = 0; p < pool_count; p++)
+    {
+        if (first <= ntohl(pools[p].range_end.s_addr) && ntohl(pools[p].range_start.s_addr) <= last)
+            return 0;
+    }
+    return 1;
+}
+
+int parse_class(char **tokens, int count, const char *path, int lineno)
+{
+    ClientClass *cls = &classes[class_count];
+    uint16_t *criteria = class_criteria[class_count];
+    uint8_t extra[CLASS_OPTIONS_MAX];
+    size_t extra_len = 0;
+    uint8_t data[256];
+    size_t len;
+    int has_mask = 0, has_dns = 0, has_router = 0;
+    uint32_t min_lease = 0, max_lease = 0;
+
+    memset(cls, 0, sizeof(*cls));
+    snprintf(cls->name, sizeof(cls->name), "%s", tokens[1]);
+    for (int i = 2; i < count; i++)
+    {
+        char *key = tokens[i], *value = strchr(tokens[i], '=');
+        int ok = 1;
+        if (value)
+            *value++ = '\0';
+
+        if (!value)
+            ok = 0;
+        else if (strcmp(key, "vendor") == 0 || strcmp(key, "user") == 0 || strcmp(key, "circuit") == 0 || strcmp(key, "remote") == 0)
+        {
+            int criterion = key[0] == 'v' ? CRITERION_VENDOR : key[0] == 'u' ? CRITERION_USER : key[0] == 'c' ? CRITERION_CIRCUIT : CRITERION_REMOTE;
+            ok = parse_bytes(value, data, &len, CLASS_VALUE_MAX) == 0;
+            if (ok)
+                criteria[criterion] = intern_value(criterion, data, len);
+        }
+        else if (strcmp(key, "oui") == 0)
+        {
+            unsigned int b[3];
+            ok = sscanf(value, "%x:%x:%x", &b[0], &b[1], &b[2]) == 3;
+            if (ok)
+            {
+                data[0] = b[0], data[1] = b[1], data[2] = b[2];
+                criteria[CRITERION_OUI] = intern_value(CRITERION_OUI, data, 3);
+            }
+        }
+        else if (strcmp(key, "pool") == 0)
+        {
+            char *dash = strchr(value, '-');
+            struct in_addr start, end;
+            if (dash)
+                *dash = '\0';
+            ok = dash && !cls->pool && pool_count < MAX_POOLS && inet_pton(AF_INET, value, &start) == 1 &&
+                 inet_pton(AF_INET, dash + 1, &end) == 1 && ntohl(start.s_addr) <= ntohl(end.s_addr) &&
+                 pool_range_free(start, end);
+            if (ok)
+            {
+                cls->pool = add_pool(start, end);
+                cls->pool->reserved = 1;
+            }
+        }
+        else if (strcmp(key, "lease") == 0)
+        {
+            int fields = sscanf(value, "%u-%u", &min_lease, &max_lease);
+            if (fields == 1)
+                max_lease = min_lease;
+            ok = fields >= 1 && min_lease > 0 && min_lease <= max_lease;
+        }
+        else if (strcmp(key, "mask") == 0)
+            ok = !has_mask++ && parse_addresses(value, data, &len) == 0 && len == 4 && append_option(extra, &extra_len, 1, data, len) == 0;
+        else if (strcmp(key, "dns") == 0)
+            ok = !has_dns++ && parse_addresses(value, data, &len) == 0 && append_option(extra, &extra_len, 6, data, len) == 0;
+        else if (strcmp(key, "router") == 0)
+            ok = !has_router++ && parse_addresses(value, data, &len) == 0 && append_option(extra, &extra_len, 3, data, len) == 0;
+        else if (strcmp(key, "domain") == 0)
+            ok = append_option(extra, &extra_len, 15, (uint8_t *)value, strlen(value)) == 0;
+        else if (strcmp(key, "option") == 0)
+        {
+            char *colon = strchr(value, ':');
+            int code = atoi(value);
+            ok = colon && code > 0 && code < 255 && code != 53 && code != 51 && code != 58 && code != 59 &&
+                 parse_bytes(colon + 1, data, &len, 255) == 0 && append_option(extra, &extra_len, code, data, len) == 0;
+        }
+        else
+            ok = 0;
+
+        if (!ok)
+        {
+            fprintf(stderr, "%s:%d: bad %s\n", path, lineno, key);
+            return -1;
+        }
+    }
+    if (min_lease)
+    {
+        if (!cls->pool)
+        {
+            fprintf(stderr, "%s:%d: lease needs pool\n", path, lineno);
+            return -1;
+        }
+        cls->pool->policy.min_lease = min_lease;
+        cls->pool->policy.max_lease = max_lease;
+    }
+
+    int defaults = (has_mask ? 0 : 1) | (has_dns ? 0 : 2) | (has_router ? 0 : 4);
+    cls->offer_template.op = 2;                  // BOOTREPLY
+    cls->offer_template.flags = htons(0x8000); // Broadcast flag
+    cls->ack_template.op = 2;
+    if (!class_encode(cls->offer_template.options, DHCPOFFER, defaults, extra, extra_len) ||
+        !class_encode(cls->ack_template.options, DHCPACK, defaults, extra, extra_len))
+    {
+        fprintf(stderr, "%s:%d: options do not fit in a reply\n", path, lineno);
+        return -1;
+    }
+    class_count++;
+    return 0;
+}
+
+// Forgets the classes of an earlier load; the pools they declared stay
+void classes_reset()
+{
+    free(dfa);
+    free(dfa_accept);
+    free(decision);
+    dfa = NULL;
+    dfa_accept = NULL;
+    decision = NULL;
+    class_count = 0;
+    memset(class_criteria, 0, sizeof(class_criteria));
+    memset(value_count, 0, sizeof(value_count));
+    memset(exact_buckets, 0, sizeof(exact_buckets));
+    memset(compatible, 0, sizeof(compatible));
+    memset(byte_column, 0, sizeof(byte_column));
+    dfa_states = 2;
+    decision_len = 0;
+    default_matches = 0;
+}
+
+int classes_load(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        perror(path);
+        return -1;
+    }
+    char line[1024];
+    char *tokens[64];
+    int lineno = 0;
+    classes_reset();
+    while (fgets(line, sizeof(line), file))
+    {
+        lineno++;
+        int count = tokenize(line, tokens, 64);
+        if (count == 0)
+            continue;
+        if (strcmp(tokens[0], "class") != 0 || count < 2 || class_count == MAX_CLASSES)
+        {
+            fprintf(stderr, "%s:%d: expected class NAME [key=value]...\n", path, lineno);
+            fclose(file);
+            return -1;
+        }
+        if (parse_class(tokens, count, path, lineno) < 0)
+        {
+            fclose(file);
+            return -1;
+        }
+    }
+    fclose(file);
+
+    build_vendor_dfa();
+    build_compatible();
+    decision = malloc(DECISION_MAX * sizeof(int32_t));
+    if (!decision || !dfa || !dfa_accept)
+    {
+        fprintf(stderr, "%s: out of memory compiling the rules\n", path);
+        return -1;
+    }
+    ClassSet all;
+    memset(&all, 0, sizeof(all));
+    for (int c = 0; c < class_count; c++)
+        set_bit(&all, c);
+    decision_root = build_node(0, &all);
+    free_memo();
+    if (decision_root == INT32_MIN)
+    {
+        fprintf(stderr, "%s: rules too entangled to compile into %d entries, or out of memory\n", path, DECISION_MAX);
+        return -1;
+    }
+    decision = realloc(decision, (decision_len ? decision_len : 1) * sizeof(int32_t));
+    LOG("%d client classes compiled into %u decision entries, %u DFA states\n", class_count, decision_len, dfa_states);
+    return 0;
+}
+
+ClientClass *classify(DHCPMessage *msg, DHCPOptions *opts)
+{
+    if (class_count == 0)
+        return NULL;
+
+    uint16_t ids[CLASS_CRITERIA] = {0};
+    uint8_t len;
+    uint8_t *data = dhcp_get_option(msg, opts, 60, &len);
+    if (data && value_count[CRITERION_VENDOR])
+        ids[CRITERION_VENDOR] = vendor_lookup(data, len);
+    data = dhcp_get_option(msg, opts, 77, &len);
+    if (data)
+        ids[CRITERION_USER] = exact_lookup(CRITERION_USER, data, len);
+    data = dhcp_get_option(msg, opts, 82, &len);
+    for (int i = 0; data && i + 2 <= len && i + 2 + data[i + 1] <= len; i += 2 + data[i + 1])
+    {
+        if (data[i] == 1)
+            ids[CRITERION_CIRCUIT] = exact_lookup(CRITERION_CIRCUIT, &data[i + 2], data[i + 1]);
+        else if (data[i] == 2)
+            ids[CRITERION_REMOTE] = exact_lookup(CRITERION_REMOTE, &data[i + 2], data[i + 1]);
+    }
+    if (msg->hlen >= 3)
+        ids[CRITERION_OUI] = exact_lookup(CRITERION_OUI, msg->chaddr, 3);
+
+    int32_t at = decision_root;
+    while (at >= 0)
+        at = decision[at + 1 + ids[decision[at]]];
+    int c = -1 - at;
+    if (c == class_count)
+    {
+        __atomic_fetch_add(&default_matches, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    __atomic_fetch_add(&classes[c].matched, 1, __ATOMIC_RELAXED);
+    return &classes[c];
+}
+
+void classes_print_stats()
+{
+    if (class_count == 0)
+        return;
+    printf("Classes:");
+    for (int c = 0; c < class_count; c++)
+    {
+        if (classes[c].matched)
+            printf(" %s %lu,", classes[c].name, classes[c].matched);
+    }
+    printf(" default %lu\n", default_matches);
+}
@@ -10,6 +10,7 @@
 #include <termios.h>
 #include <fcntl.h>
 #include <sys/time.h>
+#include "trace.h"
 
 #define BUFFER_SIZE 1024
 #define DHCP_SERVER_PORT 67
@@ -36,10 +37,14 @@ typedef struct
     uint8_t options[312];
 } DHCPMessage;
 
-void read_dhcp_options(DHCPMessage *msg)
+// Prints the options of interest and returns when the client should renew:
+// T1 (option 58) if present, half the lease time (option 51) otherwise
+uint32_t read_dhcp_options(DHCPMessage *msg)
 {
     uint8_t *options = msg->options;
-    int i = 13; // Start after the magic cookie and the first option
+    int i = 4; // Start after the magic cookie
+    uint32_t lease_time = LEASE_TIME;
+    uint32_t renewal_time = 0;
 
     struct in_addr ip_addr;
     ip_addr.s_addr = msg->yiaddr;
@@ -72,11 +77,46 @@ void read_dhcp_options(DHCPMessage *msg)
             printf("DNS Server: %s\n", inet_ntoa(dns));
         }
         break;
+        case 51: // IP Address Lease Time
+        {
+            memcpy(&lease_time, &options[i], 4);
+            lease_time = ntohl(lease_time);
+            printf("Lease Time: %u seconds\n", lease_time);
+        }
+        break;
+        case 58: // Renewal (T1) Time
+        {
+            memcpy(&renewal_time, &options[i], 4);
+            renewal_time = ntohl(renewal_time);
+            printf("Renewal Time: %u seconds\n", renewal_time);
+        }
+        break;
         }
 
         i += option_length;
     }
     printf("\n");
+
+    if (renewal_time == 0)
+        renewal_time = lease_time / 2;
+    return renewal_time ? renewal_time : 1;
+}
+
+void start_renew_timer(uint32_t renewal_time)
+{
+    struct itimerval timer;
+
+    // Fire once at T1, re-armed with the new T1 after every ACK
+    timer.it_value.tv_sec = renewal_time;
+    timer.it_value.tv_usec = 0;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 0;
+
+    if (setitimer(ITIMER_REAL, &timer, NULL) == -1)
+    {
+        perror("Error setting timer");
+        exit(1);
+    }
 }
 
 void send_dhcp_discover(int sockfd, struct sockaddr_in *server_addr)
@@ -86,7 +126,7 @@ void send_dhcp_discover(int sockfd, struct sockaddr_in *server_addr)
     discover_msg.op = 1;                  // BOOTREQUEST
     discover_msg.htype = 1;               // Ethernet
     discover_msg.hlen = 6;                // MAC address length
-    discover_msg.xid = htonl(0x12345678); // Transaction ID
+    discover_msg.xid = htonl(time(NULL) ^ getpid() << 16); // Transaction ID, a new one every run
     discover_msg.flags = htons(0x8000);   // Broadcast flag
 
     // Set DHCP options
@@ -112,6 +152,7 @@ void send_dhcp_discover(int sockfd, struct sockaddr_in *server_addr)
         exit(1);
     }
 
+    trace_point(TRACE_CLIENT_SEND, discover_msg.xid, discover_msg.chaddr);
     sendto(sockfd, &discover_msg, sizeof(discover_msg), 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
     printf("Sent DHCP DISCOVER\n");
 }
@@ -152,17 +193,18 @@ void send_dhcp_request(int sockfd, struct sockaddr_in *server_addr, DHCPMessage
     dest_addr.sin_port = htons(DHCP_SERVER_PORT);
     dest_addr.sin_addr.s_addr = INADDR_BROADCAST;
 
+    trace_point(TRACE_CLIENT_SEND, request_msg.xid, request_msg.chaddr);
     sendto(sockfd, &request_msg, sizeof(request_msg), 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
     printf("Sent DHCP REQUEST\n");
 }
 
-void handle_dhcp_ack(int sockfd, DHCPMessage *ack_msg)
+uint32_t handle_dhcp_ack(int sockfd, DHCPMessage *ack_msg)
 {
     struct in_addr assigned_ip;
     assigned_ip.s_addr = ack_msg->yiaddr;
     printf("Received DHCP ACK: \nIP Address: %s\n", inet_ntoa(assigned_ip));
 
-    read_dhcp_options(ack_msg);
+    return read_dhcp_options(ack_msg);
 }
 
 void send_dhcp_release(int sockfd, struct sockaddr_in *server_addr, DHCPMessage *ack_msg)
@@ -199,6 +241,7 @@ void send_dhcp_release(int sockfd, struct sockaddr_in *server_addr, DHCPMessage
     dest_addr.sin_port = htons(DHCP_SERVER_PORT);
     dest_addr.sin_addr.s_addr = INADDR_BROADCAST;
 
+    trace_point(TRACE_CLIENT_SEND, release_msg.xid, release_msg.chaddr);
     sendto(sockfd, &release_msg, sizeof(release_msg), 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
     printf("Sent DHCP RELEASE\n");
 }
@@ -231,6 +274,7 @@ void send_dhcp_renew(int sockfd, struct sockaddr_in *server_addr, DHCPMessage *a
 
     options[13] = 255; // End option
 
+    trace_point(TRACE_CLIENT_SEND, renew_msg.xid, renew_msg.chaddr);
     sendto(sockfd, &renew_msg, sizeof(renew_msg), 0, (struct sockaddr *)server_addr, sizeof(*server_addr));
     printf("Sent DHCP RENEW\n");
 }
@@ -264,13 +308,30 @@ int kbhit(void) {
     return 0;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
     int sockfd;
     struct sockaddr_in client_addr, server_addr;
     socklen_t server_len = sizeof(server_addr);
     char buffer[BUFFER_SIZE];
     DHCPMessage *dhcp_msg;
+    const char *trace_path = NULL;
+    uint32_t trace_sample = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            trace_path = argv[++i];
+        else if (strcmp(argv[i], "--trace-sample") == 0 && i + 1 < argc)
+            trace_sample = atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, "Usage: %s [--trace FILE [--trace-sample N]]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (trace_path && trace_start(trace_path, "client", trace_sample) < 0)
+        exit(1);
 
     // Create UDP socket
     sockfd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -306,6 +367,7 @@ int main()
         exit(1);
     }
     dhcp_msg = (DHCPMessage *)buffer;
+    trace_point(TRACE_CLIENT_RECV, dhcp_msg->xid, dhcp_msg->chaddr);
     handle_dhcp_offer(sockfd, dhcp_msg);
 
     // Send DHCPREQUEST
@@ -320,27 +382,18 @@ int main()
         exit(1);
     }
     dhcp_msg = (DHCPMessage *)buffer;
-    handle_dhcp_ack(sockfd, dhcp_msg);
+    trace_point(TRACE_CLIENT_RECV, dhcp_msg->xid, dhcp_msg->chaddr);
+    uint32_t renewal_time = handle_dhcp_ack(sockfd, dhcp_msg);
 
-    // Set up timer for lease expiration
+    // Set up timer for lease renewal
     struct sigaction sa;
-    struct itimerval timer;
 
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = &lease_timer_handler;
     sigaction(SIGALRM, &sa, NULL);
 
-    // Configure the timer to expire after LEASE_TIME seconds
-    timer.it_value.tv_sec = LEASE_TIME;
-    timer.it_value.tv_usec = 0;
-    timer.it_interval.tv_sec = LEASE_TIME;
-    timer.it_interval.tv_usec = 0;
-
-    // Start the timer
-    if (setitimer(ITIMER_REAL, &timer, NULL) == -1) {
-        perror("Error setting timer");
-        exit(1);
-    }
+    // Start the timer, renewing at the T1 the server handed out
+    start_renew_timer(renewal_time);
 
     printf("Press SPACE to release the IP address\n");
 
@@ -356,7 +409,9 @@ int main()
                 break;
             }
             dhcp_msg = (DHCPMessage *)buffer;
-            handle_dhcp_ack(sockfd, dhcp_msg);
+            trace_point(TRACE_CLIENT_RECV, dhcp_msg->xid, dhcp_msg->chaddr);
+            renewal_time = handle_dhcp_ack(sockfd, dhcp_msg);
+            start_renew_timer(renewal_time);
         }
 
         if (kbhit()) {
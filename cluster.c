@@ -0,0 +1,698 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "server.h"
+
+// Cluster mode: several server processes on the same broadcast domain share
+// the pools. Every node places CLUSTER_VIRTUAL_NODES points on a hash ring
+// from its cluster address, and that ring decides who answers what:
+//
+//   DISCOVER                 the owner of the client's chaddr
+//   REQUEST/RELEASE/DECLINE  the owner of the address it names
+//
+// and each node only allocates addresses it owns, so the owner of a client
+// offers from its own slice and the REQUEST that follows lands on it too. A
+// binding lives on exactly one node: the owner of its address.
+//
+// Membership runs over UDP: every node heartbeats the nodes it knows about
+// (the --peer seeds to begin with) listing the ones it hears from, and drops
+// a node not heard from in CLUSTER_DEAD_MS or that says it is leaving. When
+// the ring changes, bindings whose address moved are streamed in bulk over
+// TCP on the same port to their new owner and dropped locally once it has
+// them. A node taking over a range waits CLUSTER_GRACE_MS before allocating
+// from it, so the handoff lands first; a renewal for an owned address with
+// no binding (its node died) is adopted. SIGTERM/SIGINT hand everything off
+// before exiting.
+
+#define CLUSTER_MAX_NODES 32
+#define CLUSTER_VIRTUAL_NODES 64
+#define CLUSTER_HEARTBEAT_MS 500
+#define CLUSTER_DEAD_MS 2000
+#define CLUSTER_GRACE_MS 1500
+#define CLUSTER_RING_GRACE_MS 1000 // A replaced ring outlives any lookup still using it by this much
+#define CLUSTER_IO_TIMEOUT 2 // Seconds for a handoff connection to make progress
+#define CLUSTER_MAGIC 0x44484331
+
+#define CLUSTER_HEARTBEAT 1
+#define CLUSTER_LEAVE 2
+
+#define SLOT_OWNED 1    // Requests naming this address are ours
+#define SLOT_ALLOCATE 2 // And it may be offered
+
+#define HANDOFF_BATCH 256 // Records installed per mutex hold
+
+typedef struct
+{
+    uint32_t point;
+    uint8_t node;
+} ClusterPoint;
+
+typedef struct ClusterRing
+{
+    struct sockaddr_in nodes[CLUSTER_MAX_NODES + 1];
+    int node_count;
+    int self; // Index of this node, -1 once it is leaving
+    ClusterPoint points[(CLUSTER_MAX_NODES + 1) * CLUSTER_VIRTUAL_NODES];
+    int point_count;
+    uint64_t retired_at; // When it was replaced
+    struct ClusterRing *next_retired;
+} ClusterRing;
+
+typedef struct
+{
+    struct sockaddr_in address;
+    uint64_t last_seen; // Monotonic ms, 0 if never heard from directly
+    int alive;
+} ClusterMember;
+
+typedef struct
+{
+    uint32_t magic;
+    uint8_t type;
+    uint8_t count;
+    uint16_t reserved;
+    struct
+    {
+        uint32_t ip;
+        uint16_t port;
+        uint16_t reserved;
+    } members[CLUSTER_MAX_NODES];
+} ClusterMessage;
+
+// One binding on the wire, network order
+typedef struct
+{
+    uint32_t ip;
+    uint32_t relay;
+    uint32_t remaining;
+    uint32_t renew_time;
+    uint8_t chaddr[16];
+} HandoffRecord;
+
+int cluster_enabled = 0;
+
+struct sockaddr_in cluster_self;
+ClusterMember members[CLUSTER_MAX_NODES];
+int member_count = 0;
+
+// Workers read the current ring without locks. A rebuild publishes a new
+// ring and only frees the old one CLUSTER_RING_GRACE_MS later, however
+// close together the rebuilds come
+ClusterRing *current_ring;
+ClusterRing *retired_rings = NULL; // Newest first, only touched by the cluster thread
+uint8_t slot_flags[MAX_LEASES];
+uint64_t grace_until;
+int settled = 0;
+
+int cluster_udp = -1;
+int cluster_tcp = -1;
+volatile sig_atomic_t leave_requested = 0;
+pthread_mutex_t handoff_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Statistics
+uint64_t cluster_ignored = 0;
+uint64_t handed_off = 0;
+uint64_t handoff_failures = 0;
+uint64_t handoff_received = 0;
+
+uint64_t cluster_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+uint32_t cluster_hash(uint32_t hash, const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ bytes[i]) * 16777619u; // FNV-1a
+    return hash;
+}
+
+// Spreads FNV's output over the whole ring
+uint32_t cluster_mix(uint32_t hash)
+{
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+int same_address(struct sockaddr_in *a, struct sockaddr_in *b)
+{
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+int compare_points(const void *a, const void *b)
+{
+    const ClusterPoint *pa = a, *pb = b;
+    return pa->point < pb->point ? -1 : pa->point > pb->point;
+}
+
+void build_ring(ClusterRing *ring, int include_self)
+{
+    ring->node_count = 0;
+    ring->self = -1;
+    if (include_self)
+    {
+        ring->self = ring->node_count;
+        ring->nodes[ring->node_count++] = cluster_self;
+    }
+    for (int i = 0; i < member_count; i++)
+    {
+        if (members[i].alive)
+            ring->nodes[ring->node_count++] = members[i].address;
+    }
+
+    ring->point_count = 0;
+    for (int n = 0; n < ring->node_count; n++)
+    {
+        for (uint32_t v = 0; v < CLUSTER_VIRTUAL_NODES; v++)
+        {
+            uint32_t hash = cluster_hash(2166136261u, &ring->nodes[n].sin_addr, 4);
+            hash = cluster_hash(hash, &ring->nodes[n].sin_port, 2);
+            hash = cluster_hash(hash, &v, 4);
+            ring->points[ring->point_count].point = cluster_mix(hash);
+            ring->points[ring->point_count].node = n;
+            ring->point_count++;
+        }
+    }
+    qsort(ring->points, ring->point_count, sizeof(ClusterPoint), compare_points);
+}
+
+int ring_owner(ClusterRing *ring, uint32_t hash)
+{
+    if (ring->point_count == 0)
+        return -1;
+    int low = 0, high = ring->point_count;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (ring->points[mid].point < hash)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return ring->points[low % ring->point_count].node;
+}
+
+uint32_t address_hash(uint32_t addr)
+{
+    return cluster_mix(cluster_hash(2166136261u, &addr, 4));
+}
+
+uint32_t chaddr_hash(DHCPMessage *msg)
+{
+    return cluster_mix(cluster_hash(2166136261u, msg->chaddr, msg->hlen && msg->hlen <= 16 ? msg->hlen : 16));
+}
+
+// Ownership of every pool address under the ring. Until settled, only
+// addresses this node could already allocate stay allocatable
+void update_slot_flags(ClusterRing *ring, int settle)
+{
+    for (int p = 0; p < pool_count; p++)
+    {
+        AddressPool *pool = &pools[p];
+        for (uint32_t i = 0; i < pool_size(pool); i++)
+        {
+            uint32_t slot = pool->slot_base + i;
+            uint32_t addr = htonl(ntohl(pool->range_start.s_addr) + i);
+            int owned = ring->self >= 0 && ring_owner(ring, address_hash(addr)) == ring->self;
+            int allocate = owned && (settle || (slot_flags[slot] & SLOT_ALLOCATE));
+            __atomic_store_n(&slot_flags[slot], (owned ? SLOT_OWNED : 0) | (allocate ? SLOT_ALLOCATE : 0), __ATOMIC_RELAXED);
+        }
+    }
+}
+
+int cluster_accepts(DHCPMessage *msg, DHCPOptions *opts)
+{
+    ClusterRing *ring = __atomic_load_n(&current_ring, __ATOMIC_ACQUIRE);
+    uint32_t addr = 0;
+    switch (opts->message_type)
+    {
+    case DHCPREQUEST:
+        addr = msg->ciaddr ? msg->ciaddr : dhcp_get_option_addr(msg, opts, 50);
+        if (!addr)
+            addr = msg->yiaddr;
+        break;
+    case DHCPRELEASE:
+        addr = msg->yiaddr ? msg->yiaddr : msg->ciaddr;
+        break;
+    case DHCPDECLINE:
+        addr = dhcp_get_option_addr(msg, opts, 50);
+        break;
+    }
+
+    int accept;
+    struct in_addr ip = {addr};
+    AddressPool *pool = addr ? find_pool(ip) : NULL;
+    if (pool)
+        accept = __atomic_load_n(&slot_flags[pool->slot_base + ntohl(addr) - ntohl(pool->range_start.s_addr)], __ATOMIC_RELAXED) & SLOT_OWNED;
+    else
+        accept = ring->self >= 0 && ring_owner(ring, chaddr_hash(msg)) == ring->self;
+
+    if (!accept)
+        __atomic_fetch_add(&cluster_ignored, 1, __ATOMIC_RELAXED);
+    return accept;
+}
+
+int cluster_may_allocate(uint32_t slot)
+{
+    return __atomic_load_n(&slot_flags[slot], __ATOMIC_RELAXED) & SLOT_ALLOCATE;
+}
+
+int cluster_owns(uint32_t slot)
+{
+    return __atomic_load_n(&slot_flags[slot], __ATOMIC_RELAXED) & SLOT_OWNED;
+}
+
+int write_full(int sockfd, const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+    while (len > 0)
+    {
+        ssize_t n = send(sockfd, bytes, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        bytes += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Streams the records and waits for the receiver to confirm it installed them
+int send_handoff(struct sockaddr_in *node, HandoffRecord *records, size_t count)
+{
+    struct timeval timeout = {CLUSTER_IO_TIMEOUT, 0};
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0)
+        return -1;
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    uint32_t magic = htonl(CLUSTER_MAGIC);
+    uint8_t ack = 0;
+    int ok = connect(sockfd, (struct sockaddr *)node, sizeof(*node)) == 0 &&
+             write_full(sockfd, &magic, 4) == 0 &&
+             write_full(sockfd, records, count * sizeof(HandoffRecord)) == 0 &&
+             shutdown(sockfd, SHUT_WR) == 0 &&
+             recv(sockfd, &ack, 1, MSG_WAITALL) == 1 && ack == 1;
+    close(sockfd);
+    return ok ? 0 : -1;
+}
+
+// Gives every binding whose address another node owns under ring to that node
+void hand_off(ClusterRing *ring)
+{
+    pthread_mutex_lock(&handoff_lock);
+    HandoffRecord *records = malloc(MAX_LEASES * sizeof(HandoffRecord));
+    time_t now = time(NULL);
+
+    for (int n = 0; n < ring->node_count; n++)
+    {
+        if (n == ring->self)
+            continue;
+
+        size_t count = 0;
+        uint32_t slots = __atomic_load_n(&lease_slots, __ATOMIC_ACQUIRE);
+        IPLease lease;
+        for (uint32_t slot = 0; slot < slots; slot++)
+        {
+            if (!lease_read(&ip_leases[slot], &lease) || lease.lease_expiration <= now ||
+                ring_owner(ring, address_hash(lease.ip.s_addr)) != n)
+                continue;
+            HandoffRecord *record = &records[count++];
+            record->ip = lease.ip.s_addr;
+            record->relay = lease.relay.s_addr;
+            record->remaining = htonl(lease.lease_expiration - now);
+            record->renew_time = htonl(lease.renew_time);
+            memcpy(record->chaddr, lease.chaddr, 16);
+        }
+        if (count == 0)
+            continue;
+
+        char node_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &ring->nodes[n].sin_addr, node_str, sizeof(node_str));
+        if (send_handoff(&ring->nodes[n], records, count) < 0)
+        {
+            // Kept here; if the node is gone the ring changes back
+            __atomic_fetch_add(&handoff_failures, 1, __ATOMIC_RELAXED);
+            fprintf(stderr, "Handoff of %zu bindings to %s:%u failed\n", count, node_str, ntohs(ring->nodes[n].sin_port));
+            continue;
+        }
+
+        // The new owner has them: forget the ones nobody touched meanwhile
+        pthread_mutex_lock(&mutex);
+        for (size_t i = 0; i < count; i++)
+        {
+            struct in_addr ip = {records[i].ip};
+            IPLease *slot = find_lease_slot(ip);
+            if (slot && slot->ip.s_addr == records[i].ip && memcmp(slot->chaddr, records[i].chaddr, 16) == 0 &&
+                !cluster_owns(slot - ip_leases))
+                unbind_lease(slot);
+        }
+        pthread_mutex_unlock(&mutex);
+        __atomic_fetch_add(&handed_off, count, __ATOMIC_RELAXED);
+        LOG("Handed off %zu bindings to %s:%u\n", count, node_str, ntohs(ring->nodes[n].sin_port));
+    }
+
+    free(records);
+    pthread_mutex_unlock(&handoff_lock);
+}
+
+void *handoff_thread(void *arg)
+{
+    ClusterRing *ring = arg;
+    hand_off(ring);
+    free(ring);
+    return NULL;
+}
+
+void install_bindings(HandoffRecord *records, size_t count)
+{
+    pthread_mutex_lock(&mutex);
+    for (size_t i = 0; i < count; i++)
+    {
+        struct in_addr ip = {records[i].ip};
+        IPLease *lease = find_lease_slot(ip);
+        // A binding already here was adopted from a renewal and is newer. The
+        // sender may have used an older ring: not ours, nobody would serve it
+        if (lease && lease->ip.s_addr == 0 && cluster_owns(lease - ip_leases))
+            bind_lease(lease, ip, records[i].chaddr, records[i].relay, ntohl(records[i].remaining), ntohl(records[i].renew_time));
+    }
+    pthread_mutex_unlock(&mutex);
+    __atomic_fetch_add(&handoff_received, count, __ATOMIC_RELAXED);
+}
+
+void *handoff_receiver(void *arg)
+{
+    int sockfd = (int)(intptr_t)arg;
+    struct timeval timeout = {CLUSTER_IO_TIMEOUT, 0};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    uint32_t magic;
+    HandoffRecord batch[HANDOFF_BATCH];
+    size_t used = 0; // Bytes of batch filled
+    ssize_t n;
+    if (recv(sockfd, &magic, 4, MSG_WAITALL) != 4 || magic != htonl(CLUSTER_MAGIC))
+    {
+        close(sockfd);
+        return NULL;
+    }
+    while ((n = recv(sockfd, (uint8_t *)batch + used, sizeof(batch) - used, 0)) > 0)
+    {
+        used += n;
+        if (used == sizeof(batch))
+        {
+            install_bindings(batch, HANDOFF_BATCH);
+            used = 0;
+        }
+    }
+    if (n == 0 && used % sizeof(HandoffRecord) == 0)
+    {
+        install_bindings(batch, used / sizeof(HandoffRecord));
+        uint8_t ack = 1;
+        send(sockfd, &ack, 1, MSG_NOSIGNAL);
+    }
+    close(sockfd);
+    return NULL;
+}
+
+ClusterMember *find_member(struct sockaddr_in *address, int add)
+{
+    if (same_address(address, &cluster_self))
+        return NULL;
+    for (int i = 0; i < member_count; i++)
+    {
+        if (same_address(&members[i].address, address))
+            return &members[i];
+    }
+    if (!add || member_count == CLUSTER_MAX_NODES)
+        return NULL;
+    ClusterMember *member = &members[member_count++];
+    memset(member, 0, sizeof(*member));
+    member->address = *address;
+    return member;
+}
+
+void send_to_members(uint8_t type)
+{
+    ClusterMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.magic = htonl(CLUSTER_MAGIC);
+    msg.type = type;
+    for (int i = 0; i < member_count; i++)
+    {
+        if (!members[i].alive)
+            continue;
+        msg.members[msg.count].ip = members[i].address.sin_addr.s_addr;
+        msg.members[msg.count].port = members[i].address.sin_port;
+        msg.count++;
+    }
+    size_t len = offsetof(ClusterMessage, members) + msg.count * sizeof(msg.members[0]);
+    for (int i = 0; i < member_count; i++)
+        sendto(cluster_udp, &msg, len, 0, (struct sockaddr *)&members[i].address, sizeof(members[i].address));
+}
+
+// Returns 1 if the set of live nodes changed
+int receive_heartbeats(uint64_t now)
+{
+    int changed = 0;
+    ClusterMessage msg;
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len;
+    while ((len = recvfrom(cluster_udp, &msg, sizeof(msg), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len)) > 0)
+    {
+        from_len = sizeof(from);
+        if ((size_t)len < offsetof(ClusterMessage, members) || msg.magic != htonl(CLUSTER_MAGIC) ||
+            (size_t)len < offsetof(ClusterMessage, members) + msg.count * sizeof(msg.members[0]))
+            continue;
+        ClusterMember *member = find_member(&from, 1);
+        if (!member)
+            continue;
+
+        if (msg.type == CLUSTER_LEAVE)
+        {
+            changed |= member->alive;
+            member->alive = 0;
+            member->last_seen = 0;
+            continue;
+        }
+        member->last_seen = now;
+        changed |= !member->alive;
+        member->alive = 1;
+
+        // Learn about the rest of the cluster, they are only trusted once heard from
+        for (int i = 0; i < msg.count && i < CLUSTER_MAX_NODES; i++)
+        {
+            struct sockaddr_in address;
+            memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = msg.members[i].ip;
+            address.sin_port = msg.members[i].port;
+            find_member(&address, 1);
+        }
+    }
+    return changed;
+}
+
+void free_retired_rings(uint64_t now)
+{
+    for (ClusterRing **link = &retired_rings; *link;)
+    {
+        ClusterRing *ring = *link;
+        if (now - ring->retired_at < CLUSTER_RING_GRACE_MS)
+        {
+            link = &ring->next_retired;
+            continue;
+        }
+        *link = ring->next_retired;
+        free(ring);
+    }
+}
+
+void rebalance(uint64_t now, int include_self)
+{
+    ClusterRing *next = malloc(sizeof(ClusterRing));
+    if (!next)
+    {
+        perror("Cluster ring not rebuilt");
+        return;
+    }
+    build_ring(next, include_self);
+    update_slot_flags(next, 0);
+    ClusterRing *old = current_ring;
+    __atomic_store_n(&current_ring, next, __ATOMIC_RELEASE);
+    old->retired_at = now;
+    old->next_retired = retired_rings;
+    retired_rings = old;
+    grace_until = now + CLUSTER_GRACE_MS;
+    settled = 0;
+
+    if (!quiet)
+    {
+        printf("Cluster membership changed: %d nodes\n", next->node_count);
+        for (int n = 0; n < next->node_count; n++)
+            printf("  %s:%u%s\n", inet_ntoa(next->nodes[n].sin_addr), ntohs(next->nodes[n].sin_port), n == next->self ? " (this node)" : "");
+    }
+}
+
+void request_leave(int signum)
+{
+    leave_requested = 1;
+}
+
+void leave_cluster()
+{
+    rebalance(cluster_now_ms(), 0); // Stop answering, every address belongs elsewhere
+    send_to_members(CLUSTER_LEAVE);
+    hand_off(current_ring);
+    printf("Left the cluster, %lu bindings handed off\n", handed_off);
+    exit(0);
+}
+
+void *cluster_thread(void *arg)
+{
+    uint64_t last_heartbeat = 0;
+    struct pollfd pfds[2] = {{cluster_udp, POLLIN, 0}, {cluster_tcp, POLLIN, 0}};
+
+    while (1)
+    {
+        poll(pfds, 2, CLUSTER_HEARTBEAT_MS / 5);
+        if (leave_requested)
+            leave_cluster();
+        uint64_t now = cluster_now_ms();
+
+        int changed = receive_heartbeats(now);
+        for (int i = 0; i < member_count; i++)
+        {
+            if (members[i].alive && now - members[i].last_seen > CLUSTER_DEAD_MS)
+            {
+                members[i].alive = 0;
+                changed = 1;
+            }
+        }
+        if (changed)
+        {
+            rebalance(now, 1);
+            ClusterRing *copy = malloc(sizeof(ClusterRing));
+            *copy = *current_ring;
+            pthread_t tid;
+            if (pthread_create(&tid, NULL, handoff_thread, copy) == 0)
+                pthread_detach(tid);
+            else
+                free(copy);
+        }
+        if (!settled && now >= grace_until)
+        {
+            update_slot_flags(current_ring, 1);
+            settled = 1;
+        }
+        free_retired_rings(now);
+
+        int sockfd;
+        while ((sockfd = accept(cluster_tcp, NULL, NULL)) >= 0)
+        {
+            pthread_t tid;
+            if (pthread_create(&tid, NULL, handoff_receiver, (void *)(intptr_t)sockfd) == 0)
+                pthread_detach(tid);
+            else
+                close(sockfd);
+        }
+
+        if (now - last_heartbeat >= CLUSTER_HEARTBEAT_MS)
+        {
+            send_to_members(CLUSTER_HEARTBEAT);
+            last_heartbeat = now;
+        }
+    }
+    return NULL;
+}
+
+int cluster_parse_address(const char *text, struct sockaddr_in *address)
+{
+    char host[INET_ADDRSTRLEN];
+    const char *colon = strchr(text, ':');
+    if (!colon || (size_t)(colon - text) >= sizeof(host))
+        return -1;
+    memcpy(host, text, colon - text);
+    host[colon - text] = '\0';
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    address->sin_port = htons(atoi(colon + 1));
+    return inet_pton(AF_INET, host, &address->sin_addr) == 1 && address->sin_port ? 0 : -1;
+}
+
+int cluster_start(struct sockaddr_in *self, struct sockaddr_in *peers, int peer_count)
+{
+    int enable = 1;
+    cluster_self = *self;
+    cluster_udp = socket(AF_INET, SOCK_DGRAM, 0);
+    cluster_tcp = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    setsockopt(cluster_tcp, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    if (cluster_udp < 0 || cluster_tcp < 0 ||
+        bind(cluster_udp, (struct sockaddr *)self, sizeof(*self)) < 0 ||
+        bind(cluster_tcp, (struct sockaddr *)self, sizeof(*self)) < 0 || listen(cluster_tcp, 16) < 0)
+    {
+        perror("Error binding cluster sockets");
+        return -1;
+    }
+    for (int i = 0; i < peer_count; i++)
+        find_member(&peers[i], 1);
+
+    // Alone until the others answer, and no allocations before then
+    current_ring = calloc(1, sizeof(ClusterRing));
+    if (!current_ring)
+    {
+        perror("Error allocating the cluster ring");
+        return -1;
+    }
+    build_ring(current_ring, 1);
+    update_slot_flags(current_ring, 0);
+    grace_until = cluster_now_ms() + CLUSTER_DEAD_MS;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_leave;
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, cluster_thread, NULL) != 0)
+    {
+        perror("Failed to create cluster thread");
+        return -1;
+    }
+    pthread_detach(tid);
+    cluster_enabled = 1;
+    return 0;
+}
+
+void cluster_print_stats()
+{
+    if (!cluster_enabled)
+        return;
+    ClusterRing *ring = __atomic_load_n(&current_ring, __ATOMIC_ACQUIRE);
+    uint32_t owned = 0, allocatable = 0;
+    for (uint32_t slot = 0; slot < lease_slots; slot++)
+    {
+        owned += cluster_owns(slot) != 0;
+        allocatable += cluster_may_allocate(slot) != 0;
+    }
+    printf("Cluster: %d nodes, %u/%u addresses owned (%u allocatable), %lu bindings handed off (%lu failed), %lu received, %lu messages left to other nodes\n",
+           ring->node_count, owned, lease_slots, allocatable, handed_off, handoff_failures, handoff_received, cluster_ignored);
+}
@@ -0,0 +1,100 @@
+#include <string.h>
+#include "dhcp.h"
+
+int dhcp_index_options(DHCPMessage *msg, size_t len, DHCPOptions *index)
+{
+    memset(index, 0, sizeof(*index));
+    if (len < DHCP_MIN_SIZE)
+        return 0;
+
+    uint8_t *options = msg->options;
+    if (options[0] != 0x63 || options[1] != 0x82 || options[2] != 0x53 || options[3] != 0x63)
+        return 0;
+
+    size_t end = len - DHCP_HEADER_SIZE;
+    if (end > sizeof(msg->options))
+        end = sizeof(msg->options);
+    index->length = end;
+
+    size_t i = 4; // Start after the magic cookie
+    while (i < end && options[i] != 255) // 255 is the END option
+    {
+        uint8_t code = options[i++];
+        if (code == 0) // PAD
+            continue;
+        if (i >= end || i + 1 + options[i] > end)
+            break; // Truncated option, ignore the rest
+
+        // First occurrence wins
+        if (index->offset[code] == 0)
+            index->offset[code] = i;
+        i += 1 + options[i];
+    }
+    index->end = i < end ? i : end;
+
+    uint8_t *type = index->offset[53] ? &options[index->offset[53]] : NULL;
+    if (type && type[0] == 1)
+        index->message_type = type[1];
+    return 1;
+}
+
+uint8_t *dhcp_get_option(DHCPMessage *msg, DHCPOptions *index, uint8_t code, uint8_t *len)
+{
+    uint16_t offset = index->offset[code];
+    if (offset == 0)
+        return NULL;
+    *len = msg->options[offset];
+    return &msg->options[offset + 1];
+}
+
+uint32_t dhcp_get_option_addr(DHCPMessage *msg, DHCPOptions *index, uint8_t code)
+{
+    uint8_t len;
+    uint8_t *data = dhcp_get_option(msg, index, code, &len);
+    uint32_t addr = 0;
+    if (data && len == 4)
+        memcpy(&addr, data, 4);
+    return addr;
+}
+
+size_t dhcp_append_option(DHCPMessage *msg, DHCPOptions *index, size_t len, uint8_t code, const uint8_t *data, uint8_t data_len)
+{
+    size_t at = index->end;
+    if (at + 2 + data_len + 1 > sizeof(msg->options))
+        return 0;
+
+    msg->options[at] = code;
+    msg->options[at + 1] = data_len;
+    memcpy(&msg->options[at + 2], data, data_len);
+    if (index->offset[code] == 0)
+        index->offset[code] = at + 1;
+    index->end = at + 2 + data_len;
+    msg->options[index->end] = 255;
+
+    size_t needed = DHCP_HEADER_SIZE + index->end + 1;
+    if (index->length < index->end + 1)
+        index->length = index->end + 1;
+    return len > needed ? len : needed;
+}
+
+int dhcp_remove_option(DHCPMessage *msg, DHCPOptions *index, uint8_t code)
+{
+    uint16_t offset = index->offset[code];
+    if (offset == 0)
+        return 0;
+
+    // From the code byte to the end of its data
+    size_t start = offset - 1;
+    size_t size = 2 + msg->options[offset];
+    memmove(&msg->options[start], &msg->options[start + size], index->length - start - size);
+    memset(&msg->options[index->length - size], 0, size);
+
+    for (int i = 0; i < 256; i++)
+    {
+        if (index->offset[i] > offset)
+            index->offset[i] -= size;
+    }
+    index->offset[code] = 0;
+    index->end -= size;
+    return 1;
+}
@@ -0,0 +1,76 @@
+#ifndef DHCP_H
+#define DHCP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#define DHCP_HEADER_SIZE 236 // Fixed BOOTP header, everything before the options
+#define DHCP_MIN_SIZE 240    // Header plus the magic cookie
+
+// DHCP message types (option 53)
+#define DHCPDISCOVER 1
+#define DHCPOFFER 2
+#define DHCPREQUEST 3
+#define DHCPDECLINE 4
+#define DHCPACK 5
+#define DHCPNAK 6
+#define DHCPRELEASE 7
+#define DHCPINFORM 8
+#define DHCPLEASEQUERY 10 // RFC 4388 and RFC 6926 leasequery
+#define DHCPLEASEUNASSIGNED 11
+#define DHCPLEASEUNKNOWN 12
+#define DHCPLEASEACTIVE 13
+#define DHCPBULKLEASEQUERY 14
+#define DHCPLEASEQUERYDONE 15
+#define DHCPACTIVELEASEQUERY 16
+#define DHCPLEASEQUERYSTATUS 17
+
+typedef struct
+{
+    uint8_t op;
+    uint8_t htype;
+    uint8_t hlen;
+    uint8_t hops;
+    uint32_t xid;
+    uint16_t secs;
+    uint16_t flags;
+    uint32_t ciaddr;
+    uint32_t yiaddr;
+    uint32_t siaddr;
+    uint32_t giaddr;
+    uint8_t chaddr[16];
+    uint8_t sname[64];
+    uint8_t file[128];
+    uint8_t options[312];
+} DHCPMessage;
+
+// Offsets of every option present in a message, filled in a single pass so
+// handlers can look options up without walking the list again. An offset of
+// 0 means the option is absent (offset 0 is the magic cookie).
+typedef struct
+{
+    uint8_t message_type; // 0 when option 53 is missing
+    uint16_t offset[256]; // Offset of the option's length byte in options[]
+    uint16_t length;      // Bytes of options[] actually received
+    uint16_t end;         // Offset of the END option, length if missing
+} DHCPOptions;
+
+// Returns 0 when the message is too short or lacks the magic cookie
+int dhcp_index_options(DHCPMessage *msg, size_t len, DHCPOptions *index);
+
+// Returns a pointer to the option data and stores its length, NULL if absent
+uint8_t *dhcp_get_option(DHCPMessage *msg, DHCPOptions *index, uint8_t code, uint8_t *len);
+
+// Reads a 4 byte address option, returns 0 if absent or malformed
+uint32_t dhcp_get_option_addr(DHCPMessage *msg, DHCPOptions *index, uint8_t code);
+
+// Writes an option where END was and a new END after it. Returns the new
+// message length, 0 if it does not fit in options[]
+size_t dhcp_append_option(DHCPMessage *msg, DHCPOptions *index, size_t len, uint8_t code, const uint8_t *data, uint8_t data_len);
+
+// Removes an option, moving the rest down and padding the tail so the
+// message keeps its length. Returns 0 if the option was absent
+int dhcp_remove_option(DHCPMessage *msg, DHCPOptions *index, uint8_t code);
+
+#endif
@@ -0,0 +1,370 @@
+#define _GNU_SOURCE // accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <endian.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "events.h"
+
+#define EVENT_QUEUE_SIZE 65536      // Power of two
+#define EVENT_BATCH 1024            // Events taken off the queue per pass
+#define EVENT_FLUSH_MS 5            // Publisher wakeup while idle, bounds delivery latency
+#define MAX_SUBSCRIBERS 16
+#define SUBSCRIBER_BUFFER (256 * 1024) // Bytes held for a slow subscriber before dropping
+#define EVENT_JSON_MAX 192
+
+// Bounded multi-producer queue (Vyukov): each cell's seq says whose turn it
+// is, producers claim a position with a CAS on tail and the single consumer
+// (the publisher) follows head. A full queue fails the push instead of waiting
+typedef struct
+{
+    uint64_t seq;
+    LeaseEvent event;
+} EventCell;
+
+typedef struct
+{
+    int fd; // -1 when the slot is free
+    int binary;
+    int wants_binary; // Switches once the JSON already buffered is out
+    uint8_t *buffer;
+    size_t used;
+    uint64_t delivered;
+    uint64_t dropped;
+    uint64_t unreported; // Drops not yet announced with a dropped event
+    char hello[16];      // Partial "binary\n" line
+    size_t hello_len;
+} Subscriber;
+
+int events_enabled = 0;
+
+EventCell *event_cells;
+uint64_t event_tail __attribute__((aligned(64)));
+uint64_t event_head __attribute__((aligned(64)));
+uint64_t events_published = 0;
+uint64_t queue_drops = 0; // Pushes that found the queue full
+uint64_t queue_drops_seen = 0;
+
+Subscriber subscribers[MAX_SUBSCRIBERS];
+int events_listenfd = -1;
+
+void lease_event(uint8_t type, uint32_t ip, const uint8_t *chaddr, uint32_t relay, uint32_t lease_time)
+{
+    if (!__atomic_load_n(&events_enabled, __ATOMIC_ACQUIRE))
+        return;
+
+    uint64_t pos = __atomic_load_n(&event_tail, __ATOMIC_RELAXED);
+    EventCell *cell;
+    while (1)
+    {
+        cell = &event_cells[pos & (EVENT_QUEUE_SIZE - 1)];
+        int64_t diff = (int64_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&event_tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+        {
+            __atomic_fetch_add(&queue_drops, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+            pos = __atomic_load_n(&event_tail, __ATOMIC_RELAXED);
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    LeaseEvent *event = &cell->event;
+    event->type = type;
+    event->hlen = 6;
+    event->reserved = 0;
+    event->ip = ip;
+    event->relay = relay;
+    event->lease_time = lease_time;
+    event->time_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    memcpy(event->chaddr, chaddr, 16);
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+// Single consumer side, returns the number of events copied out
+int take_events(LeaseEvent *batch, int max)
+{
+    int count = 0;
+    while (count < max)
+    {
+        EventCell *cell = &event_cells[event_head & (EVENT_QUEUE_SIZE - 1)];
+        if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != event_head + 1)
+            break; // Empty, or the next producer hasn't finished writing
+        batch[count++] = cell->event;
+        __atomic_store_n(&cell->seq, event_head + EVENT_QUEUE_SIZE, __ATOMIC_RELEASE);
+        event_head++;
+    }
+    return count;
+}
+
+const char *event_names[] = {"", "commit", "renew", "release", "expire", "dropped", "decline"};
+
+size_t encode_event(Subscriber *sub, LeaseEvent *event, uint8_t *out)
+{
+    if (sub->binary)
+    {
+        LeaseEvent *record = (LeaseEvent *)out;
+        *record = *event;
+        record->lease_time = htonl(event->lease_time);
+        record->time_ns = htobe64(event->time_ns);
+        return sizeof(LeaseEvent);
+    }
+
+    if (event->type == LEASE_EVENT_DROPPED)
+        return snprintf((char *)out, EVENT_JSON_MAX, "{\"event\":\"dropped\",\"count\":%u}\n", event->lease_time);
+
+    char ip[INET_ADDRSTRLEN], relay[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &event->ip, ip, sizeof(ip));
+    inet_ntop(AF_INET, &event->relay, relay, sizeof(relay));
+    const uint8_t *mac = event->chaddr;
+    return snprintf((char *)out, EVENT_JSON_MAX,
+                    "{\"event\":\"%s\",\"time\":%lu.%03lu,\"ip\":\"%s\",\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"relay\":\"%s\",\"lease_time\":%u}\n",
+                    event_names[event->type], (unsigned long)(event->time_ns / 1000000000), (unsigned long)(event->time_ns / 1000000 % 1000),
+                    ip, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], relay, event->lease_time);
+}
+
+// Appends an event to the subscriber's buffer, or counts it as dropped.
+// Pending drops are announced first so the gap shows up where it happened
+void queue_for(Subscriber *sub, LeaseEvent *event)
+{
+    if (sub->wants_binary && sub->used == 0)
+        sub->binary = 1;
+    size_t room = sub->binary ? sizeof(LeaseEvent) : EVENT_JSON_MAX;
+    if (sub->unreported)
+    {
+        if (SUBSCRIBER_BUFFER - sub->used < 2 * room)
+        {
+            __atomic_fetch_add(&sub->dropped, 1, __ATOMIC_RELAXED);
+            sub->unreported++;
+            return;
+        }
+        LeaseEvent gap;
+        memset(&gap, 0, sizeof(gap));
+        gap.type = LEASE_EVENT_DROPPED;
+        gap.lease_time = sub->unreported > UINT32_MAX ? UINT32_MAX : sub->unreported;
+        sub->used += encode_event(sub, &gap, sub->buffer + sub->used);
+        sub->unreported = 0;
+    }
+    if (SUBSCRIBER_BUFFER - sub->used < room)
+    {
+        __atomic_fetch_add(&sub->dropped, 1, __ATOMIC_RELAXED);
+        sub->unreported++;
+        return;
+    }
+    sub->used += encode_event(sub, event, sub->buffer + sub->used);
+    __atomic_fetch_add(&sub->delivered, 1, __ATOMIC_RELAXED);
+}
+
+void close_subscriber(Subscriber *sub)
+{
+    close(sub->fd);
+    free(sub->buffer);
+    sub->buffer = NULL;
+    __atomic_store_n(&sub->fd, -1, __ATOMIC_RELAXED);
+}
+
+// Writes what the socket takes without blocking; a full socket buffer just
+// leaves the rest for the next pass
+void flush_subscriber(Subscriber *sub)
+{
+    size_t sent = 0;
+    while (sent < sub->used)
+    {
+        ssize_t n = send(sub->fd, sub->buffer + sent, sub->used - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                close_subscriber(sub);
+                return;
+            }
+            break;
+        }
+        sent += n;
+    }
+    memmove(sub->buffer, sub->buffer + sent, sub->used - sent);
+    sub->used -= sent;
+}
+
+// Anything a subscriber writes is only ever the format switch
+void read_subscriber(Subscriber *sub)
+{
+    char input[64];
+    ssize_t n = recv(sub->fd, input, sizeof(input), MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+    {
+        close_subscriber(sub);
+        return;
+    }
+    for (ssize_t i = 0; i < n; i++)
+    {
+        if (input[i] != '\n')
+        {
+            if (sub->hello_len < sizeof(sub->hello) - 1)
+                sub->hello[sub->hello_len++] = input[i];
+            continue;
+        }
+        sub->hello[sub->hello_len] = '\0';
+        if (strcmp(sub->hello, "binary") == 0)
+            sub->wants_binary = 1;
+        sub->hello_len = 0;
+    }
+}
+
+void accept_subscribers()
+{
+    int fd;
+    while ((fd = accept4(events_listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        int slot;
+        for (slot = 0; slot < MAX_SUBSCRIBERS; slot++)
+        {
+            if (subscribers[slot].fd < 0)
+                break;
+        }
+        if (slot == MAX_SUBSCRIBERS)
+        {
+            close(fd); // Full, the client sees EOF right away
+            continue;
+        }
+        Subscriber *sub = &subscribers[slot];
+        sub->buffer = malloc(SUBSCRIBER_BUFFER);
+        sub->used = 0;
+        sub->binary = 0;
+        sub->wants_binary = 0;
+        sub->hello_len = 0;
+        sub->unreported = 0;
+        __atomic_store_n(&sub->delivered, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&sub->dropped, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&sub->fd, fd, __ATOMIC_RELAXED);
+    }
+}
+
+void *event_publisher(void *arg)
+{
+    LeaseEvent *batch = malloc(EVENT_BATCH * sizeof(LeaseEvent));
+    struct pollfd pfds[MAX_SUBSCRIBERS + 1];
+    int timeout = EVENT_FLUSH_MS;
+
+    while (1)
+    {
+        int nfds = 0;
+        pfds[nfds++] = (struct pollfd){events_listenfd, POLLIN, 0};
+        for (int i = 0; i < MAX_SUBSCRIBERS; i++)
+        {
+            if (subscribers[i].fd >= 0)
+                pfds[nfds++] = (struct pollfd){subscribers[i].fd, POLLIN | (subscribers[i].used ? POLLOUT : 0), 0};
+        }
+        poll(pfds, nfds, timeout);
+
+        accept_subscribers();
+        for (int i = 0; i < MAX_SUBSCRIBERS; i++)
+        {
+            if (subscribers[i].fd >= 0)
+                read_subscriber(&subscribers[i]);
+        }
+
+        // Pushes lost on a full queue never reached anyone: every subscriber has a gap
+        uint64_t drops = __atomic_load_n(&queue_drops, __ATOMIC_RELAXED);
+        if (drops != queue_drops_seen)
+        {
+            for (int i = 0; i < MAX_SUBSCRIBERS; i++)
+            {
+                if (subscribers[i].fd >= 0)
+                    subscribers[i].unreported += drops - queue_drops_seen;
+            }
+            queue_drops_seen = drops;
+        }
+
+        int count = take_events(batch, EVENT_BATCH);
+        __atomic_fetch_add(&events_published, count, __ATOMIC_RELAXED);
+        for (int i = 0; i < MAX_SUBSCRIBERS; i++)
+        {
+            Subscriber *sub = &subscribers[i];
+            if (sub->fd < 0)
+                continue;
+            for (int e = 0; e < count; e++)
+                queue_for(sub, &batch[e]);
+            if (sub->used)
+                flush_subscriber(sub);
+        }
+
+        // Keep going without sleeping while the queue is backed up
+        timeout = count == EVENT_BATCH ? 0 : EVENT_FLUSH_MS;
+    }
+    return NULL;
+}
+
+int events_start(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Event socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    events_listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (events_listenfd < 0)
+    {
+        perror("Error creating event socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(events_listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(events_listenfd, MAX_SUBSCRIBERS) < 0)
+    {
+        perror("Error binding event socket");
+        close(events_listenfd);
+        return -1;
+    }
+
+    event_cells = malloc(EVENT_QUEUE_SIZE * sizeof(EventCell));
+    for (uint64_t i = 0; i < EVENT_QUEUE_SIZE; i++)
+        event_cells[i].seq = i;
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++)
+        subscribers[i].fd = -1;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, event_publisher, NULL) != 0)
+    {
+        close(events_listenfd);
+        return -1;
+    }
+    pthread_detach(tid);
+    __atomic_store_n(&events_enabled, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void events_print_stats()
+{
+    if (!events_enabled)
+        return;
+    printf("Events: %lu published, %lu dropped on a full queue\n",
+           __atomic_load_n(&events_published, __ATOMIC_RELAXED), __atomic_load_n(&queue_drops, __ATOMIC_RELAXED));
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++)
+    {
+        if (__atomic_load_n(&subscribers[i].fd, __ATOMIC_RELAXED) < 0)
+            continue;
+        printf("Subscriber %d: %lu delivered, %lu dropped\n", i,
+               __atomic_load_n(&subscribers[i].delivered, __ATOMIC_RELAXED),
+               __atomic_load_n(&subscribers[i].dropped, __ATOMIC_RELAXED));
+    }
+}
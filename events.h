@@ -0,0 +1,50 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+
+// Lease event stream for external subscribers (DNS updaters, firewall rules,
+// audit logs). The packet path only pushes into a bounded lock-free queue and
+// never blocks; a publisher thread drains it and fans the events out to the
+// clients of a Unix stream socket. A subscriber that can't keep up loses
+// events, counted per subscriber and reported in-band with a dropped event.
+//
+// Subscribers get NDJSON by default, one object per line:
+//   {"event":"commit","time":1700000000.123,"ip":"10.0.0.2","mac":"02:00:00:00:00:01","relay":"0.0.0.0","lease_time":3600}
+//   {"event":"dropped","count":12}
+// Writing "binary\n" to the socket switches it to LeaseEvent records with
+// every field in network order, a dropped record carrying the count in
+// lease_time.
+
+#define LEASE_EVENT_COMMIT 1
+#define LEASE_EVENT_RENEW 2
+#define LEASE_EVENT_RELEASE 3
+#define LEASE_EVENT_EXPIRE 4
+#define LEASE_EVENT_DROPPED 5
+#define LEASE_EVENT_DECLINE 6
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t hlen;
+    uint16_t reserved;
+    uint32_t ip;         // Network order, as in the lease table
+    uint32_t relay;      // giaddr the binding came through, 0 if direct
+    uint32_t lease_time; // Seconds granted; 0 for release, expire and decline
+    uint64_t time_ns;    // CLOCK_REALTIME
+    uint8_t chaddr[16];
+} LeaseEvent;
+
+extern int events_enabled;
+
+// Starts the publisher on a Unix socket at path, replacing a stale one.
+// Returns -1 on failure
+int events_start(const char *path);
+
+// Queues an event, dropping it if the queue is full. Lock-free, callable
+// from any thread with or without the mutex
+void lease_event(uint8_t type, uint32_t ip, const uint8_t *chaddr, uint32_t relay, uint32_t lease_time);
+
+void events_print_stats();
+
+#endif
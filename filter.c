@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+#include "dhcp.h"
+#include "filter.h"
+
+#define DHCP_SERVER_PORT 67
+#define DHCP_COOKIE 0x63825363
+
+// Jump targets resolved once the whole program is laid out
+#define TARGET_ACCEPT -1
+#define TARGET_DROP -2
+#define TARGET_FOUND -3
+
+typedef struct
+{
+    struct sock_filter *insns;
+    int count;
+    int jt[FILTER_MAX_INSNS]; // Target label, or 0 for a plain relative jump
+    int jf[FILTER_MAX_INSNS];
+    int ja[FILTER_MAX_INSNS];
+    int labels[4]; // Instruction index of each label, by -target
+} Assembler;
+
+void emit(Assembler *as, uint16_t code, uint32_t k)
+{
+    as->jt[as->count] = as->jf[as->count] = as->ja[as->count] = 0;
+    as->insns[as->count++] = (struct sock_filter)BPF_STMT(code, k);
+}
+
+// jt/jf are either a relative skip (>= 0) or one of the TARGET_ labels
+void emit_jump(Assembler *as, uint16_t code, uint32_t k, int jt, int jf)
+{
+    as->insns[as->count] = (struct sock_filter)BPF_JUMP(code, k, jt > 0 ? jt : 0, jf > 0 ? jf : 0);
+    as->jt[as->count] = jt < 0 ? jt : 0;
+    as->jf[as->count] = jf < 0 ? jf : 0;
+    as->ja[as->count] = 0;
+    as->count++;
+}
+
+void emit_goto(Assembler *as, int target)
+{
+    emit(as, BPF_JMP | BPF_JA, 0);
+    as->ja[as->count - 1] = target;
+}
+
+void resolve(Assembler *as)
+{
+    for (int i = 0; i < as->count; i++)
+    {
+        if (as->jt[i])
+            as->insns[i].jt = as->labels[-as->jt[i]] - (i + 1);
+        if (as->jf[i])
+            as->insns[i].jf = as->labels[-as->jf[i]] - (i + 1);
+        if (as->ja[i])
+            as->insns[i].k = as->labels[-as->ja[i]] - (i + 1);
+    }
+}
+
+// Every DHCP field is loaded relative to X, which holds the IP header length
+// on raw frames and 0 on UDP sockets, plus the constant offset in base
+int dhcp_filter_build(DHCPFilterConfig *config, int link, struct sock_filter *program)
+{
+    Assembler as;
+    memset(&as, 0, sizeof(as));
+    as.insns = program;
+    uint32_t base = 8; // UDP header
+
+    if (link == FILTER_ETHERNET)
+    {
+        // IPv4, UDP, not a fragment, to port 67
+        emit(&as, BPF_LD | BPF_H | BPF_ABS, 12);
+        emit_jump(&as, BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, TARGET_DROP);
+        emit(&as, BPF_LD | BPF_B | BPF_ABS, 23);
+        emit_jump(&as, BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, TARGET_DROP);
+        emit(&as, BPF_LD | BPF_H | BPF_ABS, 20);
+        emit_jump(&as, BPF_JMP | BPF_JSET | BPF_K, 0x3fff, TARGET_DROP, 0);
+        emit(&as, BPF_LDX | BPF_B | BPF_MSH, 14);
+        emit(&as, BPF_LD | BPF_H | BPF_IND, 16);
+        emit_jump(&as, BPF_JMP | BPF_JEQ | BPF_K, DHCP_SERVER_PORT, 0, TARGET_DROP);
+        base = 14 + 8;
+    }
+    else
+    {
+        emit(&as, BPF_LDX | BPF_IMM, 0);
+    }
+
+    // Header and cookie all there
+    emit(&as, BPF_LD | BPF_W | BPF_LEN, 0);
+    emit(&as, BPF_ALU | BPF_SUB | BPF_X, 0);
+    emit_jump(&as, BPF_JMP | BPF_JGE | BPF_K, base + DHCP_MIN_SIZE, 0, TARGET_DROP);
+
+    emit(&as, BPF_LD | BPF_B | BPF_IND, base + offsetof(DHCPMessage, op));
+    emit_jump(&as, BPF_JMP | BPF_JEQ | BPF_K, 1, 0, TARGET_DROP); // BOOTREQUEST
+    if (config->htype)
+    {
+        emit(&as, BPF_LD | BPF_B | BPF_IND, base + offsetof(DHCPMessage, htype));
+        emit_jump(&as, BPF_JMP | BPF_JEQ | BPF_K, config->htype, 0, TARGET_DROP);
+    }
+    if (config->hlen)
+    {
+        emit(&as, BPF_LD | BPF_B | BPF_IND, base + offsetof(DHCPMessage, hlen));
+        emit_jump(&as, BPF_JMP | BPF_JEQ | BPF_K, config->hlen, 0, TARGET_DROP);
+    }
+    emit(&as, BPF_LD | BPF_W | BPF_IND, base + DHCP_HEADER_SIZE);
+    emit_jump(&as, BPF_JMP | BPF_JEQ | BPF_K, DHCP_COOKIE, 0, TARGET_DROP);
+
+    // Unrolled walk over the first options, X advancing past each one
+    uint32_t options = base + DHCP_MIN_SIZE;
+    for (int i = 0; i < FILTER_OPTION_WALK; i++)
+    {
+        emit(&as, BPF_LD | BPF_B | BPF_IND, options);
+        emit_jump(&as, BPF_JMP | BPF_JEQ | BPF_K, 53, TARGET_FOUND, 0);
+        emit_jump(&as, BPF_JMP | BPF_JEQ | BPF_K, 255, TARGET_DROP, 0); // END, no type
+        emit_jump(&as, BPF_JMP | BPF_JEQ | BPF_K, 0, 5, 0);             // PAD
+        emit(&as, BPF_LD | BPF_B | BPF_IND, options + 1);
+        emit(&as, BPF_ALU | BPF_ADD | BPF_K, 2);
+        emit(&as, BPF_ALU | BPF_ADD | BPF_X, 0);
+        emit(&as, BPF_MISC | BPF_TAX, 0);
+        emit(&as, BPF_JMP | BPF_JA, 3);
+        emit(&as, BPF_MISC | BPF_TXA, 0);
+        emit(&as, BPF_ALU | BPF_ADD | BPF_K, 1);
+        emit(&as, BPF_MISC | BPF_TAX, 0);
+    }
+    emit_goto(&as, TARGET_ACCEPT); // Type further in, let the server look
+
+    as.labels[-TARGET_FOUND] = as.count;
+    emit(&as, BPF_LD | BPF_B | BPF_IND, options + 2);
+    for (int type = 1; type < 32; type++)
+    {
+        if (config->message_types & (1u << type))
+            emit_jump(&as, BPF_JMP | BPF_JEQ | BPF_K, type, TARGET_ACCEPT, 0);
+    }
+
+    as.labels[-TARGET_DROP] = as.count;
+    emit(&as, BPF_RET | BPF_K, 0);
+    as.labels[-TARGET_ACCEPT] = as.count;
+    emit(&as, BPF_RET | BPF_K, 0xffffffff);
+
+    resolve(&as);
+    return as.count;
+}
+
+int dhcp_filter_attach(int sockfd, DHCPFilterConfig *config, int link)
+{
+    struct sock_filter program[FILTER_MAX_INSNS];
+    struct sock_fprog fprog;
+    fprog.len = dhcp_filter_build(config, link, program);
+    fprog.filter = program;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0)
+    {
+        perror("Error attaching socket filter");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+#include <linux/filter.h>
+
+// Classic BPF program attached to the server socket so the kernel throws
+// away what the server would ignore anyway (short or truncated messages,
+// BOOTREPLYs such as our own broadcasts, other hardware types, no magic
+// cookie, message types without a handler) before a worker wakes up.
+
+#define FILTER_MAX_INSNS 128
+#define FILTER_OPTION_WALK 6 // Options inspected looking for option 53
+
+// Where the program sees the DHCP message start
+#define FILTER_UDP 0      // UDP socket: after the 8 byte UDP header
+#define FILTER_ETHERNET 1 // AF_PACKET socket: whole Ethernet frame
+
+typedef struct
+{
+    uint8_t htype;          // Hardware type accepted, 0 for any
+    uint8_t hlen;           // Hardware address length accepted, 0 for any
+    uint32_t message_types; // Bit n set when option 53 value n is handled
+} DHCPFilterConfig;
+
+// Returns the number of instructions written to program
+int dhcp_filter_build(DHCPFilterConfig *config, int link, struct sock_filter *program);
+
+// Builds the program and attaches it with SO_ATTACH_FILTER, -1 on failure
+int dhcp_filter_attach(int sockfd, DHCPFilterConfig *config, int link);
+
+#endif
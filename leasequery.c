@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "server.h"
+
+// Bulk leasequery (RFC 6926) over TCP. Every message either way is a DHCP
+// message preceded by its length as two bytes in network order. A
+// DHCPBULKLEASEQUERY is answered with one DHCPLEASEACTIVE per matching
+// binding and a closing DHCPLEASEQUERYDONE, or a DHCPLEASEQUERYSTATUS if the
+// query can't be served.
+//
+// The table is walked with a cursor over the lease slots, LEASEQUERY_BATCH
+// at a time. Each slot is copied through its seqlock, never the mutex, and
+// the batch is written out before the cursor moves on, so a slow consumer
+// only ever blocks its own connection thread. Every row is consistent, the
+// dump as a whole is not a point-in-time snapshot: bindings made or dropped
+// while it runs may or may not show up.
+//
+// Supported queries: all bindings; by MAC (chaddr); by relay (Relay-ID,
+// sub-option 12 of option 82, holding the relay's IPv4 giaddr); and, as a
+// local extension, by address range from ciaddr to yiaddr (just ciaddr when
+// yiaddr is 0).
+
+#define LEASEQUERY_BATCH 256   // Slots read per cursor step
+#define LEASEQUERY_BACKLOG 16
+#define LEASEQUERY_ROW_SIZE 300 // Upper bound of an encoded DHCPLEASEACTIVE with its prefix
+
+// RFC 6926 status codes (option 151)
+#define STATUS_MALFORMED_QUERY 3
+
+#define DHCP_STATE_ACTIVE 2 // Option 156
+
+typedef struct
+{
+    uint32_t xid;
+    int by_mac;
+    uint8_t chaddr[16];
+    int by_range;
+    uint32_t range_start; // Host order
+    uint32_t range_end;
+    int by_relay;
+    uint32_t relay;
+} BulkQuery;
+
+typedef struct
+{
+    int sockfd;
+    uint8_t *buffer;
+    size_t used;
+    size_t capacity;
+} QueryConnection;
+
+int read_full(int sockfd, void *data, size_t len)
+{
+    uint8_t *bytes = data;
+    while (len > 0)
+    {
+        ssize_t n = recv(sockfd, bytes, len, 0);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        bytes += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int flush_rows(QueryConnection *conn)
+{
+    size_t sent = 0;
+    while (sent < conn->used)
+    {
+        ssize_t n = send(conn->sockfd, conn->buffer + sent, conn->used - sent, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        sent += n;
+    }
+    conn->used = 0;
+    return 0;
+}
+
+uint8_t *put_option(uint8_t *p, uint8_t code, const void *data, uint8_t len)
+{
+    *p++ = code;
+    *p++ = len;
+    memcpy(p, data, len);
+    return p + len;
+}
+
+uint8_t *put_option32(uint8_t *p, uint8_t code, uint32_t value)
+{
+    value = htonl(value);
+    return put_option(p, code, &value, 4);
+}
+
+// Appends one length-prefixed reply to the connection's output buffer
+void queue_reply(QueryConnection *conn, BulkQuery *query, uint8_t type, IPLease *lease, int status)
+{
+    uint8_t *frame = conn->buffer + conn->used;
+    DHCPMessage *msg = (DHCPMessage *)(frame + 2);
+    memset(msg, 0, DHCP_MIN_SIZE);
+    msg->op = 2; // BOOTREPLY
+    msg->htype = 1;
+    msg->hlen = 6;
+    msg->xid = query->xid;
+
+    uint8_t *p = msg->options;
+    *p++ = 0x63; // Magic cookie
+    *p++ = 0x82;
+    *p++ = 0x53;
+    *p++ = 0x63;
+    p = put_option(p, 53, &type, 1);
+
+    time_t now = time(NULL);
+    if (lease)
+    {
+        msg->ciaddr = lease->ip.s_addr;
+        msg->giaddr = lease->relay.s_addr;
+        memcpy(msg->chaddr, lease->chaddr, 16);
+        uint8_t state = DHCP_STATE_ACTIVE;
+        p = put_option32(p, 51, lease->lease_expiration > now ? lease->lease_expiration - now : 0);
+        p = put_option32(p, 58, lease->renew_time);
+        p = put_option32(p, 91, now > lease->lease_start ? now - lease->lease_start : 0);
+        p = put_option(p, 156, &state, 1);
+    }
+    if (status >= 0)
+    {
+        uint8_t code = status;
+        p = put_option(p, 151, &code, 1);
+    }
+    p = put_option32(p, 152, (uint32_t)now); // Base time for the relative times above
+    *p++ = 255;
+
+    uint16_t len = DHCP_HEADER_SIZE + (p - msg->options);
+    frame[0] = len >> 8;
+    frame[1] = len & 0xff;
+    conn->used += 2 + len;
+}
+
+int query_matches(BulkQuery *query, IPLease *lease)
+{
+    if (query->by_mac && memcmp(lease->chaddr, query->chaddr, 16) != 0)
+        return 0;
+    if (query->by_relay && lease->relay.s_addr != query->relay)
+        return 0;
+    if (query->by_range)
+    {
+        uint32_t ip = ntohl(lease->ip.s_addr);
+        if (ip < query->range_start || ip > query->range_end)
+            return 0;
+    }
+    return 1;
+}
+
+// Returns the RFC 6926 status the query fails with, or -1 if it is valid
+int parse_query(DHCPMessage *msg, size_t len, BulkQuery *query)
+{
+    DHCPOptions opts;
+    memset(query, 0, sizeof(*query));
+    query->xid = msg->xid;
+    if (!dhcp_index_options(msg, len, &opts) || opts.message_type != DHCPBULKLEASEQUERY)
+        return STATUS_MALFORMED_QUERY;
+
+    static const uint8_t no_mac[16];
+    if (memcmp(msg->chaddr, no_mac, 16) != 0)
+    {
+        query->by_mac = 1;
+        memcpy(query->chaddr, msg->chaddr, 16);
+    }
+    if (msg->ciaddr)
+    {
+        query->by_range = 1;
+        query->range_start = ntohl(msg->ciaddr);
+        query->range_end = msg->yiaddr ? ntohl(msg->yiaddr) : query->range_start;
+        if (query->range_end < query->range_start)
+            return STATUS_MALFORMED_QUERY;
+    }
+
+    uint8_t agent_len;
+    uint8_t *agent = dhcp_get_option(msg, &opts, 82, &agent_len);
+    for (int i = 0; agent && i + 2 <= agent_len; i += 2 + agent[i + 1])
+    {
+        if (agent[i] == 12) // Relay-ID
+        {
+            if (agent[i + 1] != 4 || i + 6 > agent_len)
+                return STATUS_MALFORMED_QUERY;
+            query->by_relay = 1;
+            memcpy(&query->relay, &agent[i + 2], 4);
+        }
+    }
+    return -1;
+}
+
+// Streams every matching binding, a batch of slots at a time
+int run_query(QueryConnection *conn, BulkQuery *query)
+{
+    uint32_t slots = __atomic_load_n(&lease_slots, __ATOMIC_ACQUIRE);
+    time_t now = time(NULL);
+    IPLease lease;
+
+    for (uint32_t cursor = 0; cursor < slots; cursor += LEASEQUERY_BATCH)
+    {
+        uint32_t end = cursor + LEASEQUERY_BATCH < slots ? cursor + LEASEQUERY_BATCH : slots;
+        for (uint32_t slot = cursor; slot < end; slot++)
+        {
+            if (lease_read(&ip_leases[slot], &lease) && lease.lease_expiration > now && query_matches(query, &lease))
+                queue_reply(conn, query, DHCPLEASEACTIVE, &lease, -1);
+        }
+        if (flush_rows(conn) < 0)
+            return -1;
+    }
+    queue_reply(conn, query, DHCPLEASEQUERYDONE, NULL, -1);
+    return flush_rows(conn);
+}
+
+void *leasequery_connection(void *arg)
+{
+    QueryConnection conn;
+    conn.sockfd = (int)(intptr_t)arg;
+    conn.used = 0;
+    conn.capacity = (size_t)LEASEQUERY_BATCH * LEASEQUERY_ROW_SIZE + LEASEQUERY_ROW_SIZE;
+    conn.buffer = malloc(conn.capacity);
+
+    int enable = 1;
+    setsockopt(conn.sockfd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    while (1)
+    {
+        uint8_t prefix[2];
+        DHCPMessage msg;
+        if (read_full(conn.sockfd, prefix, 2) < 0)
+            break;
+        size_t len = prefix[0] << 8 | prefix[1];
+        if (len > sizeof(msg))
+            break; // Not something we can parse, the stream is lost
+        memset(&msg, 0, sizeof(msg));
+        if (read_full(conn.sockfd, &msg, len) < 0)
+            break;
+
+        BulkQuery query;
+        int status = parse_query(&msg, len, &query);
+        if (status >= 0)
+        {
+            queue_reply(&conn, &query, DHCPLEASEQUERYSTATUS, NULL, status);
+            if (flush_rows(&conn) < 0)
+                break;
+            continue;
+        }
+        if (run_query(&conn, &query) < 0)
+            break;
+    }
+
+    close(conn.sockfd);
+    free(conn.buffer);
+    return NULL;
+}
+
+void *leasequery_accept(void *arg)
+{
+    int listenfd = (int)(intptr_t)arg;
+    while (1)
+    {
+        int sockfd = accept(listenfd, NULL, NULL);
+        if (sockfd < 0)
+        {
+            if (errno != EINTR)
+                perror("Error accepting leasequery connection");
+            continue;
+        }
+
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, leasequery_connection, (void *)(intptr_t)sockfd) != 0)
+        {
+            close(sockfd);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    return NULL;
+}
+
+int leasequery_start(uint16_t port)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int enable = 1;
+
+    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenfd < 0)
+    {
+        perror("Error creating leasequery socket");
+        return -1;
+    }
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenfd, LEASEQUERY_BACKLOG) < 0)
+    {
+        perror("Error binding leasequery socket");
+        close(listenfd);
+        return -1;
+    }
+    getsockname(listenfd, (struct sockaddr *)&addr, &len);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, leasequery_accept, (void *)(intptr_t)listenfd) != 0)
+    {
+        close(listenfd);
+        return -1;
+    }
+    pthread_detach(tid);
+    return ntohs(addr.sin_port);
+}
@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include "server.h"
+
+// Raw packet engine: an AF_PACKET socket bound to one interface with
+// TPACKET_V3 RX and TX rings mapped into our memory. Requests are parsed in
+// place from the RX blocks (Ethernet/IPv4/UDP/DHCP), replies are written
+// straight into TX frames and a whole batch leaves with one sendto kick.
+// Unlike the UDP socket it knows which interface every request came from.
+
+#define RX_BLOCK_SIZE (1 << 18)
+#define RX_BLOCK_COUNT 16
+#define RX_BLOCK_TIMEOUT 1 // Milliseconds before a partly filled block is handed over
+#define TX_BLOCK_SIZE (1 << 16)
+#define TX_BLOCK_COUNT 8
+#define FRAME_SIZE 2048
+#define DHCP_CLIENT_PORT 68
+
+typedef struct __attribute__((packed))
+{
+    uint8_t version_ihl;
+    uint8_t tos;
+    uint16_t total_length;
+    uint16_t id;
+    uint16_t fragment;
+    uint8_t ttl;
+    uint8_t protocol;
+    uint16_t checksum;
+    uint32_t saddr;
+    uint32_t daddr;
+} IPv4Header;
+
+typedef struct __attribute__((packed))
+{
+    uint16_t source;
+    uint16_t dest;
+    uint16_t length;
+    uint16_t checksum;
+} UDPHeader;
+
+struct PacketEngine
+{
+    int sockfd;
+    int ifindex;
+    uint8_t mac[ETH_ALEN];
+    uint32_t ip; // Interface address, source of our replies
+
+    uint8_t *ring;
+    size_t ring_size;
+    uint8_t *rx_ring;
+    unsigned rx_block;
+    uint8_t *tx_ring;
+    unsigned tx_frame;
+    unsigned tx_frames;
+    unsigned tx_pending;
+
+    uint8_t peer_mac[ETH_ALEN]; // Sender of the request being handled
+
+    // Statistics
+    uint64_t received;
+    uint64_t sent;
+    uint64_t kicks;
+    uint64_t tx_full;
+    uint16_t ip_id;
+};
+
+uint16_t ip_checksum(void *data, size_t len)
+{
+    uint32_t sum = 0;
+    uint16_t *words = data;
+    for (size_t i = 0; i < len / 2; i++)
+        sum += words[i];
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum;
+}
+
+// Sends every frame marked since the last kick in one syscall
+void packet_kick(PacketEngine *engine)
+{
+    if (engine->tx_pending == 0)
+        return;
+    if (sendto(engine->sockfd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 && errno != EAGAIN)
+        perror("Error sending replies");
+    engine->tx_pending = 0;
+    engine->kicks++;
+}
+
+// Builds the reply frame in the next free TX slot. Like the socket engines
+// it answers whoever sent the request: unicast to its MAC, or broadcast to
+// port 68 when the client has no address yet
+void packet_deliver(void *arg, DHCPMessage *reply, struct sockaddr_in *dest)
+{
+    PacketEngine *engine = arg;
+    struct tpacket3_hdr *frame = (struct tpacket3_hdr *)(engine->tx_ring + engine->tx_frame * FRAME_SIZE);
+    if (__atomic_load_n(&frame->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE)
+    {
+        packet_kick(engine); // Ring full, push out what is queued first
+        if (__atomic_load_n(&frame->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE)
+        {
+            engine->tx_full++;
+            return;
+        }
+    }
+
+    int broadcast = dest->sin_addr.s_addr == INADDR_ANY || dest->sin_addr.s_addr == INADDR_BROADCAST;
+    size_t payload = sizeof(*reply);
+    uint8_t *data = (uint8_t *)frame + TPACKET3_HDRLEN - sizeof(struct sockaddr_ll);
+
+    struct ethhdr *eth = (struct ethhdr *)data;
+    memset(eth->h_dest, 0xff, ETH_ALEN);
+    if (!broadcast)
+        memcpy(eth->h_dest, engine->peer_mac, ETH_ALEN);
+    memcpy(eth->h_source, engine->mac, ETH_ALEN);
+    eth->h_proto = htons(ETH_P_IP);
+
+    IPv4Header *ip = (IPv4Header *)(eth + 1);
+    ip->version_ihl = 0x45;
+    ip->tos = 0;
+    ip->total_length = htons(sizeof(IPv4Header) + sizeof(UDPHeader) + payload);
+    ip->id = htons(engine->ip_id++);
+    ip->fragment = 0;
+    ip->ttl = 64;
+    ip->protocol = IPPROTO_UDP;
+    ip->checksum = 0;
+    ip->saddr = engine->ip;
+    ip->daddr = broadcast ? INADDR_BROADCAST : dest->sin_addr.s_addr;
+    ip->checksum = ip_checksum(ip, sizeof(*ip));
+
+    UDPHeader *udp = (UDPHeader *)(ip + 1);
+    udp->source = htons(DHCP_SERVER_PORT);
+    udp->dest = broadcast ? htons(DHCP_CLIENT_PORT) : dest->sin_port;
+    udp->length = htons(sizeof(UDPHeader) + payload);
+    udp->checksum = 0; // Optional over IPv4
+    memcpy(udp + 1, reply, payload);
+
+    frame->tp_len = sizeof(*eth) + sizeof(*ip) + sizeof(*udp) + payload;
+    frame->tp_next_offset = 0;
+    __atomic_store_n(&frame->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+    engine->tx_frame = (engine->tx_frame + 1) % engine->tx_frames;
+    engine->tx_pending++;
+    engine->sent++;
+}
+
+// Pulls the DHCP payload out of a frame without copying it
+void packet_handle_frame(PacketEngine *engine, ReplySink *sink, struct tpacket3_hdr *hdr)
+{
+    uint8_t *frame = (uint8_t *)hdr + hdr->tp_mac;
+    size_t len = hdr->tp_snaplen;
+    if (len < sizeof(struct ethhdr) + sizeof(IPv4Header) + sizeof(UDPHeader))
+        return;
+
+    struct ethhdr *eth = (struct ethhdr *)frame;
+    IPv4Header *ip = (IPv4Header *)(eth + 1);
+    size_t ip_len = (ip->version_ihl & 0x0f) * 4;
+    if ((ip->version_ihl >> 4) != 4 || ip_len < sizeof(IPv4Header) || sizeof(*eth) + ip_len + sizeof(UDPHeader) > len)
+        return;
+
+    UDPHeader *udp = (UDPHeader *)((uint8_t *)ip + ip_len);
+    size_t udp_len = ntohs(udp->length);
+    size_t available = len - sizeof(*eth) - ip_len;
+    if (udp_len < sizeof(UDPHeader) || udp_len > available)
+        return;
+
+    struct sockaddr_in client_addr;
+    memset(&client_addr, 0, sizeof(client_addr));
+    client_addr.sin_family = AF_INET;
+    client_addr.sin_addr.s_addr = ip->saddr;
+    client_addr.sin_port = udp->source;
+    memcpy(engine->peer_mac, eth->h_source, ETH_ALEN);
+
+    engine->received++;
+    process_dhcp_message(sink, (DHCPMessage *)(udp + 1), udp_len - sizeof(UDPHeader), &client_addr);
+}
+
+PacketEngine *packet_engine_create(const char *ifname)
+{
+    PacketEngine *engine = calloc(1, sizeof(PacketEngine));
+    struct ifreq ifr;
+    int version = TPACKET_V3;
+    int enable = 1;
+
+    engine->sockfd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP));
+    if (engine->sockfd < 0)
+    {
+        perror("Error creating packet socket");
+        free(engine);
+        return NULL;
+    }
+
+    // Interface index, hardware and IPv4 address
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+    if (ioctl(engine->sockfd, SIOCGIFINDEX, &ifr) < 0)
+    {
+        perror("Error finding interface");
+        goto fail;
+    }
+    engine->ifindex = ifr.ifr_ifindex;
+    if (ioctl(engine->sockfd, SIOCGIFHWADDR, &ifr) < 0)
+    {
+        perror("Error reading interface address");
+        goto fail;
+    }
+    memcpy(engine->mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+    ifr.ifr_addr.sa_family = AF_INET;
+    if (ioctl(engine->sockfd, SIOCGIFADDR, &ifr) == 0)
+        engine->ip = ((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr.s_addr;
+    else
+        engine->ip = default_gateway.s_addr; // Unnumbered interface
+
+    // Filter before the rings exist so nothing else lands in them
+    DHCPFilterConfig filter;
+    server_filter_config(&filter);
+    if (dhcp_filter_attach(engine->sockfd, &filter, FILTER_ETHERNET) < 0)
+        goto fail;
+    setsockopt(engine->sockfd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &enable, sizeof(enable));
+    if (setsockopt(engine->sockfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+    {
+        perror("Error selecting TPACKET_V3");
+        goto fail;
+    }
+
+    struct tpacket_req3 rx_req;
+    memset(&rx_req, 0, sizeof(rx_req));
+    rx_req.tp_block_size = RX_BLOCK_SIZE;
+    rx_req.tp_block_nr = RX_BLOCK_COUNT;
+    rx_req.tp_frame_size = FRAME_SIZE;
+    rx_req.tp_frame_nr = RX_BLOCK_SIZE / FRAME_SIZE * RX_BLOCK_COUNT;
+    rx_req.tp_retire_blk_tov = RX_BLOCK_TIMEOUT;
+    if (setsockopt(engine->sockfd, SOL_PACKET, PACKET_RX_RING, &rx_req, sizeof(rx_req)) < 0)
+    {
+        perror("Error creating RX ring");
+        goto fail;
+    }
+
+    struct tpacket_req3 tx_req;
+    memset(&tx_req, 0, sizeof(tx_req));
+    tx_req.tp_block_size = TX_BLOCK_SIZE;
+    tx_req.tp_block_nr = TX_BLOCK_COUNT;
+    tx_req.tp_frame_size = FRAME_SIZE;
+    tx_req.tp_frame_nr = TX_BLOCK_SIZE / FRAME_SIZE * TX_BLOCK_COUNT;
+    if (setsockopt(engine->sockfd, SOL_PACKET, PACKET_TX_RING, &tx_req, sizeof(tx_req)) < 0)
+    {
+        perror("Error creating TX ring");
+        goto fail;
+    }
+    engine->tx_frames = tx_req.tp_frame_nr;
+
+    // Both rings share one mapping, RX first
+    size_t rx_size = (size_t)RX_BLOCK_SIZE * RX_BLOCK_COUNT;
+    engine->ring_size = rx_size + (size_t)TX_BLOCK_SIZE * TX_BLOCK_COUNT;
+    engine->ring = mmap(NULL, engine->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, engine->sockfd, 0);
+    if (engine->ring == MAP_FAILED)
+        engine->ring = mmap(NULL, engine->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, engine->sockfd, 0);
+    if (engine->ring == MAP_FAILED)
+    {
+        perror("Error mapping packet rings");
+        goto fail;
+    }
+    engine->rx_ring = engine->ring;
+    stats_sockfd = engine->sockfd;
+    engine->tx_ring = engine->ring + rx_size;
+
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_IP);
+    addr.sll_ifindex = engine->ifindex;
+    if (bind(engine->sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("Error binding packet socket");
+        munmap(engine->ring, engine->ring_size);
+        goto fail;
+    }
+    return engine;
+
+fail:
+    close(engine->sockfd);
+    free(engine);
+    return NULL;
+}
+
+void packet_engine_run(PacketEngine *engine)
+{
+    ReplySink sink = {-1, packet_deliver, engine};
+    struct pollfd pfd = {engine->sockfd, POLLIN | POLLERR, 0};
+    time_t last_tick = time(NULL);
+
+    while (1)
+    {
+        struct tpacket_block_desc *block = (struct tpacket_block_desc *)(engine->rx_ring + engine->rx_block * RX_BLOCK_SIZE);
+        if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+        {
+            if (poll(&pfd, 1, 1000) < 0 && errno != EINTR)
+            {
+                perror("poll error");
+                return;
+            }
+        }
+        else
+        {
+            // Every request of the block, then their replies in one go
+            struct tpacket3_hdr *hdr = (struct tpacket3_hdr *)((uint8_t *)block + block->hdr.bh1.offset_to_first_pkt);
+            for (uint32_t i = 0; i < block->hdr.bh1.num_pkts; i++)
+            {
+                packet_handle_frame(engine, &sink, hdr);
+                hdr = (struct tpacket3_hdr *)((uint8_t *)hdr + hdr->tp_next_offset);
+            }
+            packet_kick(engine);
+
+            __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+            engine->rx_block = (engine->rx_block + 1) % RX_BLOCK_COUNT;
+        }
+
+        time_t now = time(NULL);
+        if (now != last_tick)
+        {
+            pthread_mutex_lock(&mutex);
+            expire_leases(now);
+            update_pool_stats();
+            pthread_mutex_unlock(&mutex);
+            last_tick = now;
+        }
+    }
+}
+
+void packet_engine_stats(PacketEngine *engine, uint64_t *received, uint64_t *sent, uint64_t *kicks, uint64_t *drops)
+{
+    *received = engine->received;
+    *sent = engine->sent;
+    *kicks = engine->kicks;
+    *drops = engine->tx_full; // Ring drops are reported with the lease table
+}
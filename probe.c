@@ -0,0 +1,533 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/ip.h>
+#include <linux/icmp.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include "server.h"
+
+// Address conflict probing ahead of the OFFER. A prober thread keeps a small
+// set of addresses it has just checked (ICMP echo, or an RFC 5227 ARP probe
+// on the client link) for each pool and the DISCOVER handler only ever takes
+// from the set of the pool it allocates from, so no worker waits on a probe
+// and a class with its own pool never drains the others. Each free slot goes
+// through:
+//
+//   IDLE -> PENDING (probe out) -> VERIFIED (no answer by PROBE_TIMEOUT_MS,
+//   queued in the set) -> OFFERED (taken by a worker)
+//
+// and to CONFLICT if anything answers for it. A verified address stays good
+// for PROBE_TTL and is probed again in place (RECHECK, still offerable)
+// before that runs out while it waits in the set. Conflicted addresses,
+// and those a client declined, are skipped by either allocator for
+// PROBE_QUARANTINE. Offered ones that were never requested are probed again
+// once their TTL is over.
+
+#define PROBE_TARGET 32 // Verified addresses kept ready per pool
+#define PROBE_RING 64   // Power of two, at least PROBE_TARGET
+#define PROBE_MAX_INFLIGHT 16
+#define PROBE_TIMEOUT_MS 500
+#define PROBE_TTL 60         // Seconds a clean probe is trusted
+#define PROBE_QUARANTINE 600 // Seconds a conflicted address is left alone
+#define PROBE_RETRY 5        // Seconds before retrying a probe that couldn't be sent
+#define PROBE_SCAN 4096      // Slots looked at per tick for new candidates
+
+// Timeouts run on a wheel of WHEEL_TICK_MS buckets; PROBE_TIMEOUT_MS fits in
+// one turn, so entries never need a rounds count
+#define WHEEL_TICK_MS 10
+#define WHEEL_SLOTS 64
+
+#define PROBE_IDLE 0
+#define PROBE_PENDING 1
+#define PROBE_VERIFIED 2
+#define PROBE_RECHECK 3
+#define PROBE_OFFERED 4
+#define PROBE_CONFLICT 5
+
+typedef struct
+{
+    uint32_t slot;
+    int refresh; // Recheck of an address already in the set
+    int next;    // Next probe in the same bucket or free list, -1 at the end
+} Probe;
+
+typedef struct __attribute__((packed))
+{
+    uint16_t htype;
+    uint16_t ptype;
+    uint8_t hlen;
+    uint8_t plen;
+    uint16_t op;
+    uint8_t sha[6];
+    uint32_t spa;
+    uint8_t tha[6];
+    uint32_t tpa;
+} ArpPacket;
+
+int probing_enabled = 0;
+
+uint8_t probe_state[MAX_LEASES];
+time_t probe_until[MAX_LEASES]; // TTL end, quarantine end or retry time depending on state
+
+// Verified set of a pool: the prober pushes, workers pop under the mutex
+typedef struct
+{
+    uint32_t slots[PROBE_RING];
+    uint32_t head;
+    uint32_t tail;
+    int pending; // New addresses being probed for this ring
+} VerifiedRing;
+
+VerifiedRing verified[MAX_POOLS]; // Indexed like pools[]
+
+Probe probes[PROBE_MAX_INFLIGHT];
+int free_probes;
+int wheel[WHEEL_SLOTS];
+uint64_t wheel_tick;
+int inflight = 0;
+uint32_t scan_cursor = 0;
+
+int probe_method;
+int probe_sockfd = -1;
+int probe_ifindex;
+uint8_t probe_mac[6];
+uint16_t echo_id;
+
+// Statistics
+uint64_t probes_sent = 0;
+uint64_t probe_conflicts = 0;
+uint64_t probe_send_errors = 0;
+uint64_t probe_starved = 0; // DISCOVERs that found the set empty
+
+uint64_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+uint8_t load_state(uint32_t slot)
+{
+    return __atomic_load_n(&probe_state[slot], __ATOMIC_ACQUIRE);
+}
+
+int move_state(uint32_t slot, uint8_t from, uint8_t to)
+{
+    return __atomic_compare_exchange_n(&probe_state[slot], &from, to, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+void set_until(uint32_t slot, time_t until)
+{
+    __atomic_store_n(&probe_until[slot], until, __ATOMIC_RELEASE);
+}
+
+time_t load_until(uint32_t slot)
+{
+    return __atomic_load_n(&probe_until[slot], __ATOMIC_ACQUIRE);
+}
+
+int slot_pool(uint32_t slot)
+{
+    for (int i = 0; i < pool_count; i++)
+    {
+        if (slot >= pools[i].slot_base && slot < pools[i].slot_base + pool_size(&pools[i]))
+            return i;
+    }
+    return -1;
+}
+
+struct in_addr slot_address(uint32_t slot)
+{
+    struct in_addr ip;
+    int i = slot_pool(slot);
+    ip.s_addr = i < 0 ? INADDR_NONE : htonl(ntohl(pools[i].range_start.s_addr) + slot - pools[i].slot_base);
+    return ip;
+}
+
+int address_slot(uint32_t addr)
+{
+    struct in_addr ip = {addr};
+    AddressPool *pool = find_pool(ip);
+    if (!pool)
+        return -1;
+    return pool->slot_base + ntohl(addr) - ntohl(pool->range_start.s_addr);
+}
+
+uint16_t icmp_checksum(void *data, size_t len)
+{
+    uint16_t *words = data;
+    uint32_t sum = 0;
+    for (; len > 1; len -= 2)
+        sum += *words++;
+    if (len)
+        sum += *(uint8_t *)words;
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += sum >> 16;
+    return ~sum;
+}
+
+int send_probe(uint32_t slot)
+{
+    struct in_addr ip = slot_address(slot);
+
+    if (probe_method == PROBE_ARP)
+    {
+        // RFC 5227 probe: sender address 0 so no cache learns the candidate
+        ArpPacket arp;
+        memset(&arp, 0, sizeof(arp));
+        arp.htype = htons(ARPHRD_ETHER);
+        arp.ptype = htons(ETH_P_IP);
+        arp.hlen = 6;
+        arp.plen = 4;
+        arp.op = htons(ARPOP_REQUEST);
+        memcpy(arp.sha, probe_mac, 6);
+        arp.tpa = ip.s_addr;
+
+        struct sockaddr_ll dest;
+        memset(&dest, 0, sizeof(dest));
+        dest.sll_family = AF_PACKET;
+        dest.sll_protocol = htons(ETH_P_ARP);
+        dest.sll_ifindex = probe_ifindex;
+        dest.sll_halen = 6;
+        memset(dest.sll_addr, 0xff, 6);
+        return sendto(probe_sockfd, &arp, sizeof(arp), 0, (struct sockaddr *)&dest, sizeof(dest)) < 0 ? -1 : 0;
+    }
+
+    struct
+    {
+        struct icmphdr header;
+        uint32_t slot;
+    } echo;
+    memset(&echo, 0, sizeof(echo));
+    echo.header.type = ICMP_ECHO;
+    echo.header.un.echo.id = echo_id;
+    echo.header.un.echo.sequence = htons(slot & 0xffff);
+    echo.slot = slot;
+    echo.header.checksum = icmp_checksum(&echo, sizeof(echo));
+
+    struct sockaddr_in dest;
+    memset(&dest, 0, sizeof(dest));
+    dest.sin_family = AF_INET;
+    dest.sin_addr = ip;
+    return sendto(probe_sockfd, &echo, sizeof(echo), 0, (struct sockaddr *)&dest, sizeof(dest)) < 0 ? -1 : 0;
+}
+
+void wheel_insert(int probe, uint64_t ticks)
+{
+    int bucket = (wheel_tick + ticks) % WHEEL_SLOTS;
+    probes[probe].next = wheel[bucket];
+    wheel[bucket] = probe;
+}
+
+int start_probe(uint32_t slot, int refresh)
+{
+    if (free_probes < 0)
+        return -1;
+    if (send_probe(slot) < 0)
+    {
+        if (probe_send_errors++ == 0)
+            perror("Error sending conflict probe");
+        return -1;
+    }
+    probes_sent++;
+
+    int probe = free_probes;
+    free_probes = probes[probe].next;
+    probes[probe].slot = slot;
+    probes[probe].refresh = refresh;
+    wheel_insert(probe, PROBE_TIMEOUT_MS / WHEEL_TICK_MS);
+    inflight++;
+    return 0;
+}
+
+// Whoever answers for an address we are about to hand out is using it
+void mark_conflict(uint32_t addr)
+{
+    int slot = address_slot(addr);
+    if (slot < 0)
+        return;
+    uint8_t state = load_state(slot);
+    if ((state == PROBE_PENDING || state == PROBE_VERIFIED || state == PROBE_RECHECK) && move_state(slot, state, PROBE_CONFLICT))
+    {
+        set_until(slot, time(NULL) + PROBE_QUARANTINE);
+        __atomic_fetch_add(&probe_conflicts, 1, __ATOMIC_RELAXED);
+        struct in_addr ip = {addr};
+        LOG("Address conflict on %s, quarantined\n", inet_ntoa(ip));
+    }
+}
+
+void read_replies()
+{
+    uint8_t buffer[1500];
+    ssize_t len;
+    while ((len = recv(probe_sockfd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+    {
+        if (probe_method == PROBE_ARP)
+        {
+            ArpPacket *arp = (ArpPacket *)buffer;
+            if (len >= (ssize_t)sizeof(ArpPacket) && arp->ptype == htons(ETH_P_IP) && arp->spa != 0)
+                mark_conflict(arp->spa);
+            continue;
+        }
+
+        struct iphdr *ip = (struct iphdr *)buffer;
+        size_t header_len = ip->ihl * 4;
+        if ((size_t)len < header_len + sizeof(struct icmphdr))
+            continue;
+        struct icmphdr *icmp = (struct icmphdr *)(buffer + header_len);
+        if (icmp->type == ICMP_ECHOREPLY && icmp->un.echo.id == echo_id)
+            mark_conflict(ip->saddr);
+    }
+}
+
+uint32_t ring_count(VerifiedRing *ring)
+{
+    return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+// A ring that still wants new addresses, counting those being probed
+int ring_wants(VerifiedRing *ring)
+{
+    return ring_count(ring) + ring->pending < PROBE_TARGET;
+}
+
+// Buckets whose time has come: a probe nobody answered verifies its address
+void advance_wheel(uint64_t now_tick)
+{
+    time_t now = time(NULL);
+    while (wheel_tick < now_tick)
+    {
+        int bucket = wheel_tick % WHEEL_SLOTS;
+        int probe = wheel[bucket];
+        wheel[bucket] = -1;
+        wheel_tick++;
+
+        while (probe >= 0)
+        {
+            int next = probes[probe].next;
+            uint32_t slot = probes[probe].slot;
+            VerifiedRing *ring = &verified[slot_pool(slot)];
+            if (probes[probe].refresh)
+            {
+                if (move_state(slot, PROBE_RECHECK, PROBE_VERIFIED))
+                    set_until(slot, now + PROBE_TTL);
+            }
+            else
+            {
+                ring->pending--;
+                if (ring_count(ring) < PROBE_TARGET && move_state(slot, PROBE_PENDING, PROBE_VERIFIED))
+                {
+                    set_until(slot, now + PROBE_TTL);
+                    ring->slots[ring->tail % PROBE_RING] = slot;
+                    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+                }
+                else
+                    move_state(slot, PROBE_PENDING, PROBE_IDLE);
+            }
+
+            probes[probe].next = free_probes;
+            free_probes = probe;
+            inflight--;
+            probe = next;
+        }
+    }
+}
+
+// Rechecks queued addresses halfway through their TTL so the set never
+// goes stale while traffic is low
+void refresh_verified()
+{
+    time_t now = time(NULL);
+    for (int p = 0; p < pool_count; p++)
+    {
+        VerifiedRing *ring = &verified[p];
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (uint32_t i = head; i != ring->tail && inflight < PROBE_MAX_INFLIGHT; i++)
+        {
+            uint32_t slot = ring->slots[i % PROBE_RING];
+            if (load_state(slot) == PROBE_VERIFIED && load_until(slot) - now < PROBE_TTL / 2 &&
+                move_state(slot, PROBE_VERIFIED, PROBE_RECHECK) && start_probe(slot, 1) < 0)
+                move_state(slot, PROBE_RECHECK, PROBE_VERIFIED);
+        }
+    }
+}
+
+// Free slots never checked, offered and not bound within their TTL, or out
+// of quarantine. probe_until doubles as a not-before time for IDLE slots
+void top_up()
+{
+    time_t now = time(NULL);
+    uint32_t slots = __atomic_load_n(&lease_slots, __ATOMIC_ACQUIRE);
+    int wanting = 0;
+    for (int p = 0; p < pool_count; p++)
+        wanting += ring_wants(&verified[p]);
+    for (int scanned = 0; scanned < PROBE_SCAN && slots > 0; scanned++)
+    {
+        if (!wanting || inflight >= PROBE_MAX_INFLIGHT)
+            return;
+        uint32_t slot = scan_cursor++ % slots;
+        int p = slot_pool(slot);
+        if (p < 0 || !ring_wants(&verified[p]))
+            continue; // That pool's set is full already
+        if (__atomic_load_n(&ip_leases[slot].ip.s_addr, __ATOMIC_RELAXED) != 0 || (cluster_enabled && !cluster_may_allocate(slot)))
+            continue; // Bound, or another cluster node's to offer
+
+        uint8_t state = load_state(slot);
+        if ((state != PROBE_IDLE && state != PROBE_OFFERED && state != PROBE_CONFLICT) || load_until(slot) > now)
+            continue;
+        if (!move_state(slot, state, PROBE_PENDING))
+            continue;
+        if (start_probe(slot, 0) < 0)
+        {
+            set_until(slot, now + PROBE_RETRY);
+            move_state(slot, PROBE_PENDING, PROBE_IDLE);
+            continue;
+        }
+        verified[p].pending++;
+        wanting -= !ring_wants(&verified[p]);
+    }
+}
+
+void *prober(void *arg)
+{
+    struct pollfd pfd = {probe_sockfd, POLLIN, 0};
+    while (1)
+    {
+        poll(&pfd, 1, WHEEL_TICK_MS);
+        read_replies();
+        advance_wheel(monotonic_ms() / WHEEL_TICK_MS);
+        refresh_verified();
+        top_up();
+    }
+    return NULL;
+}
+
+int probe_start(int method, const char *ifname)
+{
+    probe_method = method;
+    if (method == PROBE_ARP)
+    {
+        probe_sockfd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_ARP));
+        probe_ifindex = if_nametoindex(ifname);
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+        if (probe_sockfd < 0 || probe_ifindex == 0 || ioctl(probe_sockfd, SIOCGIFHWADDR, &ifr) < 0)
+        {
+            perror("Error opening ARP probe socket");
+            return -1;
+        }
+        memcpy(probe_mac, ifr.ifr_hwaddr.sa_data, 6);
+
+        struct sockaddr_ll addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sll_family = AF_PACKET;
+        addr.sll_protocol = htons(ETH_P_ARP);
+        addr.sll_ifindex = probe_ifindex;
+        if (bind(probe_sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("Error binding ARP probe socket");
+            return -1;
+        }
+    }
+    else
+    {
+        probe_sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+        if (probe_sockfd < 0)
+        {
+            perror("Error opening ICMP probe socket");
+            return -1;
+        }
+        struct icmp_filter filter = {~(1u << ICMP_ECHOREPLY)};
+        setsockopt(probe_sockfd, SOL_RAW, ICMP_FILTER, &filter, sizeof(filter));
+        echo_id = htons(getpid() & 0xffff);
+    }
+
+    for (int i = 0; i < PROBE_MAX_INFLIGHT; i++)
+        probes[i].next = i + 1 < PROBE_MAX_INFLIGHT ? i + 1 : -1;
+    free_probes = 0;
+    for (int i = 0; i < WHEEL_SLOTS; i++)
+        wheel[i] = -1;
+    wheel_tick = monotonic_ms() / WHEEL_TICK_MS;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, prober, NULL) != 0)
+    {
+        perror("Failed to create prober thread");
+        return -1;
+    }
+    pthread_detach(tid);
+    probing_enabled = 1;
+    return 0;
+}
+
+// Called with the mutex held, which makes the workers a single consumer.
+// Takes from the given pool's set, or from the sets of the pools no class
+// reserved when pool is NULL
+struct in_addr probe_take(AddressPool *pool)
+{
+    time_t now = time(NULL);
+    struct in_addr ip;
+    for (int p = 0; p < pool_count; p++)
+    {
+        if (pool ? &pools[p] != pool : pools[p].reserved)
+            continue;
+        VerifiedRing *ring = &verified[p];
+        while (ring->head != __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+        {
+            uint32_t slot = ring->slots[ring->head % PROBE_RING];
+            __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+
+            uint8_t state = load_state(slot);
+            if (state != PROBE_VERIFIED && state != PROBE_RECHECK)
+                continue; // Conflicted while queued
+            if (ip_leases[slot].ip.s_addr != 0 || load_until(slot) <= now || (cluster_enabled && !cluster_may_allocate(slot)))
+            {
+                move_state(slot, state, PROBE_IDLE); // Bound, stale or handed to another node meanwhile, probe again later
+                continue;
+            }
+            if (!move_state(slot, state, PROBE_OFFERED))
+                continue;
+            set_until(slot, now + PROBE_TTL);
+            return slot_address(slot);
+        }
+    }
+    __atomic_fetch_add(&probe_starved, 1, __ATOMIC_RELAXED);
+    ip.s_addr = INADDR_NONE;
+    return ip;
+}
+
+void probe_quarantine(struct in_addr ip)
+{
+    int slot = address_slot(ip.s_addr);
+    if (slot < 0)
+        return;
+    set_until(slot, time(NULL) + PROBE_QUARANTINE);
+    __atomic_store_n(&probe_state[slot], PROBE_CONFLICT, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&probe_conflicts, 1, __ATOMIC_RELAXED);
+}
+
+int probe_quarantined(uint32_t slot)
+{
+    return load_state(slot) == PROBE_CONFLICT && load_until(slot) > time(NULL);
+}
+
+void probe_print_stats()
+{
+    if (!probing_enabled)
+        return;
+    uint32_t ready = 0;
+    for (int p = 0; p < pool_count; p++)
+        ready += ring_count(&verified[p]);
+    printf("Probes: %lu sent, %u verified ready, %lu conflicts, %lu send errors, %lu offers without a verified address\n",
+           probes_sent, ready, probe_conflicts, probe_send_errors, probe_starved);
+}
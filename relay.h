@@ -0,0 +1,80 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "dhcp.h"
+
+// DHCP relay agent: worker threads each own a client-facing socket (shared
+// port through SO_REUSEPORT) and a server-facing socket, both served from
+// an epoll set with recvmmsg/sendmmsg batches. Replies find their way back
+// through a bounded table of xid+chaddr -> downstream address entries.
+//
+// Clients are spread over the upstream servers by consistent hashing of
+// chaddr, so each one keeps talking to the server that holds its lease.
+// Upstreams are judged from the replies they send (or do not) and a dark
+// one hands its clients to the next server on the ring until it answers a
+// periodic probe again.
+
+#define RELAY_MAX_THREADS 64
+#define RELAY_BATCH 64            // Datagrams per recvmmsg/sendmmsg
+#define RELAY_BUFFER_SIZE 1500    // One Ethernet MTU per datagram
+#define RELAY_TABLE_BUCKETS 16384 // Power of two
+#define RELAY_TABLE_WAYS 4        // Return paths per bucket before evicting
+#define RELAY_ROUTE_TTL 30        // Seconds a return path is remembered
+#define RELAY_MAX_HOPS 16         // RFC 1542 limit
+#define RELAY_MAX_UPSTREAMS 16
+#define RELAY_VIRTUAL_NODES 64    // Ring points per upstream
+#define RELAY_FAIL_THRESHOLD 4    // Unanswered requests before an upstream can be dark
+#define RELAY_MIN_TIMEOUT_MS 500  // Reply deadline floor, otherwise 4x the mean latency
+#define RELAY_PROBE_INTERVAL 5    // Seconds between requests let through to a dark upstream
+
+typedef struct
+{
+    struct in_addr listen_ip;  // Client-facing address, INADDR_ANY for all
+    uint16_t listen_port;      // 0 picks an ephemeral port
+    struct in_addr giaddr;     // Relay agent address written into requests
+    struct sockaddr_in servers[RELAY_MAX_UPSTREAMS];
+    int server_count;
+    char circuit_id[64]; // Option 82 sub-options 1 and 2, left out when empty
+    char remote_id[64];
+    int threads;
+    int quiet;
+} RelayConfig;
+
+typedef struct
+{
+    struct sockaddr_in address;
+    int healthy;
+    uint64_t requests;    // Forwarded to this server
+    uint64_t replies;
+    uint64_t lost;        // Requests never answered before their route expired
+    uint64_t failovers;   // Requests taken over from a dark upstream
+    uint64_t send_errors;
+    double latency_avg_ms;
+    double latency_max_ms;
+} RelayUpstreamStats;
+
+typedef struct
+{
+    uint64_t requests;    // Forwarded to a server
+    uint64_t replies;     // Routed back to a client
+    uint64_t unroutable;  // Replies with no return path
+    uint64_t dropped;     // Truncated, looping or unknown messages
+    uint64_t evictions;   // Live return paths pushed out of a full bucket
+    uint64_t send_errors;
+    uint64_t batches;     // recvmmsg calls that returned data
+    int upstream_count;
+    RelayUpstreamStats upstreams[RELAY_MAX_UPSTREAMS];
+} RelayStats;
+
+typedef struct Relay Relay;
+
+// Binds the sockets and starts the workers, NULL on failure
+Relay *relay_start(RelayConfig *config);
+// Client-facing address actually bound, with the ephemeral port resolved
+struct sockaddr_in relay_address(Relay *relay);
+// Sum of every worker's counters
+void relay_stats(Relay *relay, RelayStats *stats);
+
+#endif
@@ -1,137 +1,822 @@
+#define _GNU_SOURCE // recvmmsg/sendmmsg
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include "relay.h"
+#include "trace.h"
 
-#define BUFFER_SIZE 1024
 #define DHCP_SERVER_PORT 69
 #define DHCP_RELAY_PORT 67
+#define RELAY_STATS_INTERVAL 10 // Seconds between stats lines
 
+// Where the reply to a client's transaction has to go
 typedef struct
 {
-    uint8_t op;
-    uint8_t htype;
-    uint8_t hlen;
-    uint8_t hops;
     uint32_t xid;
-    uint16_t secs;
-    uint16_t flags;
-    uint32_t ciaddr;
-    uint32_t yiaddr;
-    uint32_t siaddr;
-    uint32_t giaddr;
     uint8_t chaddr[16];
-    uint8_t sname[64];
-    uint8_t file[128];
-    uint8_t options[312];
-} DHCPMessage;
+    struct sockaddr_in downstream;
+    uint32_t expires; // Monotonic seconds, 0 when the way is free
+    uint8_t upstream; // Server the request went to
+    uint8_t expect_reply;
+    uint8_t answered;
+    uint64_t sent; // Monotonic nanoseconds
+} RelayRoute;
 
-void relay_dhcp_message(int from_socket, int to_socket, struct sockaddr_in *from_addr, struct sockaddr_in *to_addr)
+typedef struct
+{
+    pthread_mutex_t lock;
+    RelayRoute ways[RELAY_TABLE_WAYS];
+} RelayBucket;
+
+// Outgoing datagrams of one batch, pointing into the receive buffers
+typedef struct
+{
+    struct mmsghdr msgs[RELAY_BATCH];
+    struct iovec iov[RELAY_BATCH];
+    struct sockaddr_in dest[RELAY_BATCH];
+    int upstream[RELAY_BATCH]; // -1 towards clients
+    int count;
+} RelayBatch;
+
+// Health of an upstream, shared by every worker
+typedef struct
+{
+    struct sockaddr_in address;
+    uint32_t unanswered;       // Requests sent since the last reply
+    uint64_t first_unanswered; // When the oldest of them went out, 0 if none
+    uint64_t latency;          // Moving average of the reply time, ns
+    uint64_t last_probe;       // Last request let through while dark
+} RelayUpstream;
+
+typedef struct
+{
+    uint32_t point;
+    int upstream;
+} RelayRingPoint;
+
+// Per worker counters of one upstream
+typedef struct
+{
+    uint64_t requests;
+    uint64_t replies;
+    uint64_t lost;
+    uint64_t failovers;
+    uint64_t send_errors;
+    uint64_t latency_total;
+    uint64_t latency_max;
+} RelayUpstreamCounters;
+
+typedef struct
+{
+    Relay *relay;
+    pthread_t thread;
+    int client_sockfd; // Shares the relay port with the other workers
+    int server_sockfd; // Own ephemeral port towards the server
+    int epfd;
+
+    uint8_t (*buffers)[RELAY_BUFFER_SIZE];
+    struct mmsghdr rx[RELAY_BATCH];
+    struct iovec rx_iov[RELAY_BATCH];
+    struct sockaddr_in rx_addr[RELAY_BATCH];
+    RelayBatch to_server;
+    RelayBatch to_client;
+
+    // Written by this worker only, summed by relay_stats
+    RelayStats stats;
+    RelayUpstreamCounters upstream_stats[RELAY_MAX_UPSTREAMS];
+} RelayWorker;
+
+struct Relay
+{
+    RelayConfig config;
+    struct sockaddr_in address;
+    RelayBucket *routes;
+    RelayUpstream upstreams[RELAY_MAX_UPSTREAMS];
+    int upstream_count;
+    RelayRingPoint ring[RELAY_MAX_UPSTREAMS * RELAY_VIRTUAL_NODES];
+    int ring_size;
+    uint8_t agent_option[255]; // Option 82 payload, built once
+    uint8_t agent_option_len;
+    int worker_count;
+    RelayWorker workers[RELAY_MAX_THREADS];
+};
+
+uint64_t relay_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Route expiry works in whole seconds, never 0 which marks a free way
+uint32_t relay_seconds(uint64_t now)
+{
+    return (uint32_t)(now / 1000000000ull) + 1;
+}
+
+uint32_t relay_hash(uint32_t hash, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ data[i]) * 16777619u; // FNV-1a
+    return hash;
+}
+
+// Mixes the bits FNV leaves clustered, the ring needs them spread evenly
+uint32_t relay_mix(uint32_t hash)
+{
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+RelayBucket *relay_bucket(Relay *relay, DHCPMessage *msg)
 {
-    char buffer[BUFFER_SIZE];
-    socklen_t addr_len = sizeof(struct sockaddr_in);
+    uint32_t hash = relay_hash(2166136261u, (uint8_t *)&msg->xid, 4);
+    hash = relay_hash(hash, msg->chaddr, 16);
+    return &relay->routes[hash & (RELAY_TABLE_BUCKETS - 1)];
+}
+
+int relay_compare_points(const void *a, const void *b)
+{
+    uint32_t x = ((RelayRingPoint *)a)->point, y = ((RelayRingPoint *)b)->point;
+    return x < y ? -1 : x > y;
+}
 
-    ssize_t recv_len = recvfrom(from_socket, buffer, BUFFER_SIZE, 0, (struct sockaddr *)from_addr, &addr_len);
-    if (recv_len < 0)
+// Every upstream owns RELAY_VIRTUAL_NODES points hashed from its address,
+// so adding or removing one only moves the clients next to its points
+void relay_build_ring(Relay *relay)
+{
+    relay->ring_size = 0;
+    for (int i = 0; i < relay->upstream_count; i++)
     {
-        perror("Error receiving data");
-        return;
+        struct sockaddr_in *address = &relay->upstreams[i].address;
+        for (uint32_t node = 0; node < RELAY_VIRTUAL_NODES; node++)
+        {
+            uint32_t hash = relay_hash(2166136261u, (uint8_t *)&address->sin_addr, 4);
+            hash = relay_hash(hash, (uint8_t *)&address->sin_port, 2);
+            hash = relay_hash(hash, (uint8_t *)&node, 4);
+            relay->ring[relay->ring_size].point = relay_mix(hash);
+            relay->ring[relay->ring_size].upstream = i;
+            relay->ring_size++;
+        }
     }
+    qsort(relay->ring, relay->ring_size, sizeof(RelayRingPoint), relay_compare_points);
+}
 
-    DHCPMessage *dhcp_msg = (DHCPMessage *)buffer;
+uint64_t relay_reply_timeout(RelayUpstream *upstream)
+{
+    uint64_t timeout = 4 * __atomic_load_n(&upstream->latency, __ATOMIC_RELAXED);
+    uint64_t floor = RELAY_MIN_TIMEOUT_MS * 1000000ull;
+    return timeout > floor ? timeout : floor;
+}
 
-    // Increment the hops field
-    dhcp_msg->hops++;
+// Dark once several requests in a row went unanswered for longer than the
+// server usually takes to reply
+int relay_upstream_healthy(RelayUpstream *upstream, uint64_t now)
+{
+    uint32_t unanswered = __atomic_load_n(&upstream->unanswered, __ATOMIC_RELAXED);
+    uint64_t first = __atomic_load_n(&upstream->first_unanswered, __ATOMIC_RELAXED);
+    if (unanswered < RELAY_FAIL_THRESHOLD || first == 0 || now < first)
+        return 1;
+    return now - first < relay_reply_timeout(upstream);
+}
 
-    // If this is a request from a client, set the giaddr field
-    if (dhcp_msg->op == 1 && dhcp_msg->giaddr == 0)
+// Lets a single request through to a dark upstream every probe interval,
+// a reply to it brings the upstream back
+int relay_probe_due(RelayUpstream *upstream, uint64_t now)
+{
+    uint64_t last = __atomic_load_n(&upstream->last_probe, __ATOMIC_RELAXED);
+    if (now - last < RELAY_PROBE_INTERVAL * 1000000000ull)
+        return 0;
+    return __atomic_compare_exchange_n(&upstream->last_probe, &last, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+// The owner of chaddr on the ring, or the next healthy upstream after it
+int relay_choose_upstream(Relay *relay, DHCPMessage *msg, uint64_t now, int *failover)
+{
+    uint32_t hash = relay_mix(relay_hash(2166136261u, msg->chaddr, msg->hlen && msg->hlen <= 16 ? msg->hlen : 16));
+    int low = 0, high = relay->ring_size;
+    while (low < high)
     {
-        struct in_addr relay_ip;
-        inet_pton(AF_INET, "192.168.182.129", &relay_ip); // Replace with your relay's IP
-        dhcp_msg->giaddr = relay_ip.s_addr;
+        int mid = (low + high) / 2;
+        if (relay->ring[mid].point < hash)
+            low = mid + 1;
+        else
+            high = mid;
     }
 
-    // Print information about the received message
-    printf("Received DHCP message from %s:%d\n",
-           inet_ntoa(from_addr->sin_addr), ntohs(from_addr->sin_port));
+    *failover = 0;
+    int start = low % relay->ring_size;
+    int owner = relay->ring[start].upstream;
+    if (relay_upstream_healthy(&relay->upstreams[owner], now) || relay_probe_due(&relay->upstreams[owner], now))
+        return owner;
 
-    // Forward the message
-    ssize_t sent_len = sendto(to_socket, buffer, recv_len, 0, (struct sockaddr *)to_addr, sizeof(*to_addr));
-    if (sent_len < 0)
+    for (int i = 1; i < relay->ring_size; i++)
     {
-        perror("Error sending data");
-        return;
+        int candidate = relay->ring[(start + i) % relay->ring_size].upstream;
+        if (candidate != owner && relay_upstream_healthy(&relay->upstreams[candidate], now))
+        {
+            *failover = 1;
+            return candidate;
+        }
     }
+    return owner; // Everything is dark, keep trying the owner
+}
 
-    printf("Relayed DHCP message to %s:%d\n",
-           inet_ntoa(to_addr->sin_addr), ntohs(to_addr->sin_port));
+void relay_request_sent(RelayUpstream *upstream, uint64_t now)
+{
+    uint64_t none = 0;
+    __atomic_fetch_add(&upstream->unanswered, 1, __ATOMIC_RELAXED);
+    __atomic_compare_exchange_n(&upstream->first_unanswered, &none, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
 }
 
-int main(int argc, char *argv[])
+void relay_reply_received(RelayUpstream *upstream, uint64_t latency)
+{
+    __atomic_store_n(&upstream->unanswered, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&upstream->first_unanswered, 0, __ATOMIC_RELAXED);
+
+    // Moving average with a 1/8 weight for the new sample
+    uint64_t old = __atomic_load_n(&upstream->latency, __ATOMIC_RELAXED);
+    uint64_t updated;
+    do
+        updated = old ? old - old / 8 + latency / 8 : latency;
+    while (!__atomic_compare_exchange_n(&upstream->latency, &old, updated, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Requests overwritten or expired without a reply count as lost
+void relay_reclaim(RelayWorker *worker, RelayRoute *route)
 {
-    int client_socket, server_socket;
-    struct sockaddr_in relay_addr, server_addr, client_addr;
+    if (route->expires && route->expect_reply && !route->answered)
+        worker->upstream_stats[route->upstream].lost++;
+}
+
+int relay_route_matches(RelayRoute *route, DHCPMessage *msg)
+{
+    return route->xid == msg->xid && memcmp(route->chaddr, msg->chaddr, 16) == 0;
+}
 
-    // Create sockets
-    client_socket = socket(AF_INET, SOCK_DGRAM, 0);
-    server_socket = socket(AF_INET, SOCK_DGRAM, 0);
-    if (client_socket < 0 || server_socket < 0)
+// Remembers where a request came from. A full bucket gives up the way
+// closest to expiring, so the table stays bounded under any load
+void relay_remember(Relay *relay, RelayWorker *worker, DHCPMessage *msg, struct sockaddr_in *from, int upstream, int expect_reply, uint64_t sent)
+{
+    uint32_t now = relay_seconds(sent);
+    RelayBucket *bucket = relay_bucket(relay, msg);
+    pthread_mutex_lock(&bucket->lock);
+
+    RelayRoute *route = NULL;
+    RelayRoute *oldest = &bucket->ways[0];
+    for (int i = 0; i < RELAY_TABLE_WAYS; i++)
     {
-        perror("Error creating socket");
-        exit(1);
+        RelayRoute *way = &bucket->ways[i];
+        if (way->expires > now && relay_route_matches(way, msg))
+        {
+            route = way;
+            break;
+        }
+        if (!route && way->expires <= now)
+            route = way; // Free or expired, keep looking for the same key
+        if (way->expires < oldest->expires)
+            oldest = way;
+    }
+    if (!route)
+    {
+        route = oldest;
+        worker->stats.evictions++;
+    }
+
+    relay_reclaim(worker, route);
+    route->xid = msg->xid;
+    memcpy(route->chaddr, msg->chaddr, 16);
+    route->downstream = *from;
+    route->expires = now + RELAY_ROUTE_TTL;
+    route->upstream = upstream;
+    route->expect_reply = expect_reply;
+    route->answered = 0;
+    route->sent = sent;
+    pthread_mutex_unlock(&bucket->lock);
+}
+
+// The entry is kept until it expires: OFFER and ACK share the xid. The
+// first reply to each request feeds the upstream's latency and health
+int relay_lookup(Relay *relay, RelayWorker *worker, DHCPMessage *msg, struct sockaddr_in *downstream, uint64_t now)
+{
+    RelayBucket *bucket = relay_bucket(relay, msg);
+    int found = 0;
+    pthread_mutex_lock(&bucket->lock);
+    for (int i = 0; i < RELAY_TABLE_WAYS; i++)
+    {
+        RelayRoute *way = &bucket->ways[i];
+        if (way->expires > relay_seconds(now) && relay_route_matches(way, msg))
+        {
+            *downstream = way->downstream;
+            found = 1;
+            if (!way->answered)
+            {
+                RelayUpstreamCounters *counters = &worker->upstream_stats[way->upstream];
+                uint64_t latency = now > way->sent ? now - way->sent : 0;
+                way->answered = 1;
+                counters->replies++;
+                counters->latency_total += latency;
+                if (latency > counters->latency_max)
+                    counters->latency_max = latency;
+                relay_reply_received(&relay->upstreams[way->upstream], latency);
+            }
+            break;
+        }
     }
+    pthread_mutex_unlock(&bucket->lock);
+    return found;
+}
 
-    // Configure relay address
-    memset(&relay_addr, 0, sizeof(relay_addr));
-    relay_addr.sin_family = AF_INET;
-    relay_addr.sin_addr.s_addr = INADDR_ANY;
-    relay_addr.sin_port = htons(DHCP_RELAY_PORT);
+void relay_queue(RelayBatch *batch, uint8_t *data, size_t len, struct sockaddr_in *dest, int upstream)
+{
+    int i = batch->count++;
+    batch->upstream[i] = upstream;
+    batch->iov[i].iov_base = data;
+    batch->iov[i].iov_len = len;
+    batch->dest[i] = *dest;
+    memset(&batch->msgs[i], 0, sizeof(batch->msgs[i]));
+    batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+    batch->msgs[i].msg_hdr.msg_iovlen = 1;
+    batch->msgs[i].msg_hdr.msg_name = &batch->dest[i];
+    batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->dest[i]);
+}
 
-    // Configure server address
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(DHCP_SERVER_PORT);
-    server_addr.sin_addr.s_addr = inet_addr(argv[1]);
+void relay_flush(RelayWorker *worker, int sockfd, RelayBatch *batch)
+{
+    int done = 0;
+    while (done < batch->count)
+    {
+        int sent = sendmmsg(sockfd, batch->msgs + done, batch->count - done, 0);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // Skip the datagram the kernel refused
+            worker->stats.send_errors++;
+            if (batch->upstream[done] >= 0)
+                worker->upstream_stats[batch->upstream[done]].send_errors++;
+            done++;
+            continue;
+        }
+        done += sent;
+    }
+    for (int i = 0; i < batch->count; i++)
+    {
+        DHCPMessage *msg = batch->iov[i].iov_base;
+        trace_point(TRACE_RELAYED, msg->xid, msg->chaddr);
+    }
+    batch->count = 0;
+}
 
-    // Bind client socket
-    if (bind(client_socket, (struct sockaddr *)&relay_addr, sizeof(relay_addr)) < 0)
+void relay_log(Relay *relay, const char *what, struct sockaddr_in *from, struct sockaddr_in *to)
+{
+    if (relay->config.quiet)
+        return;
+    char from_ip[INET_ADDRSTRLEN], to_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &from->sin_addr, from_ip, sizeof(from_ip));
+    inet_ntop(AF_INET, &to->sin_addr, to_ip, sizeof(to_ip));
+    printf("Relayed DHCP %s from %s:%d to %s:%d\n", what, from_ip, ntohs(from->sin_port), to_ip, ntohs(to->sin_port));
+}
+
+// Requests go upstream with the relay address in giaddr and the agent
+// information option, replies go to whoever sent the matching request.
+// Both sockets feed the same logic: a server may answer on giaddr:67
+// instead of the port it was sent from
+void relay_process(RelayWorker *worker, int index, size_t len, uint64_t now)
+{
+    Relay *relay = worker->relay;
+    uint8_t *data = worker->buffers[index];
+    DHCPMessage *msg = (DHCPMessage *)data;
+    struct sockaddr_in *from = &worker->rx_addr[index];
+
+    if (len < DHCP_HEADER_SIZE)
     {
-        perror("Error binding client socket");
-        exit(1);
+        worker->stats.dropped++;
+        return;
+    }
+
+    trace_point(TRACE_RELAY_RECV, msg->xid, msg->chaddr);
+    if (msg->op == 1)
+    {
+        if (msg->hops >= RELAY_MAX_HOPS)
+        {
+            worker->stats.dropped++;
+            return;
+        }
+        msg->hops++;
+
+        DHCPOptions opts;
+        int indexed = dhcp_index_options(msg, len, &opts);
+        if (msg->giaddr == 0)
+        {
+            // First relay on the path, RFC 3046 says we tag the request
+            msg->giaddr = relay->config.giaddr.s_addr;
+            if (indexed && relay->agent_option_len && !opts.offset[82])
+            {
+                size_t tagged = dhcp_append_option(msg, &opts, len, 82, relay->agent_option, relay->agent_option_len);
+                if (tagged)
+                    len = tagged;
+            }
+        }
+        int expect_reply = !indexed || (opts.message_type != DHCPRELEASE && opts.message_type != DHCPDECLINE);
+
+        int failover;
+        int upstream = relay_choose_upstream(relay, msg, now, &failover);
+        RelayUpstreamCounters *counters = &worker->upstream_stats[upstream];
+        counters->requests++;
+        counters->failovers += failover;
+        if (expect_reply)
+            relay_request_sent(&relay->upstreams[upstream], now);
+
+        relay_remember(relay, worker, msg, from, upstream, expect_reply, now);
+        relay_queue(&worker->to_server, data, len, &relay->upstreams[upstream].address, upstream);
+        worker->stats.requests++;
+        relay_log(relay, "request", from, &relay->upstreams[upstream].address);
     }
+    else if (msg->op == 2)
+    {
+        struct sockaddr_in downstream;
+        if (!relay_lookup(relay, worker, msg, &downstream, now))
+        {
+            worker->stats.unroutable++;
+            return;
+        }
+
+        // The agent information is ours, clients never see it
+        DHCPOptions opts;
+        if (msg->giaddr == relay->config.giaddr.s_addr && dhcp_index_options(msg, len, &opts))
+            dhcp_remove_option(msg, &opts, 82);
 
-    printf("DHCP Relay is running...\n");
+        // Clients without an address yet are only reachable by broadcast
+        if (downstream.sin_addr.s_addr == INADDR_ANY)
+            downstream.sin_addr.s_addr = INADDR_BROADCAST;
 
-    fd_set readfds;
-    int max_fd = (client_socket > server_socket) ? client_socket : server_socket;
+        relay_queue(&worker->to_client, data, len, &downstream, -1);
+        worker->stats.replies++;
+        relay_log(relay, "reply", from, &downstream);
+    }
+    else
+    {
+        worker->stats.dropped++;
+    }
+}
 
+// Drains a socket a batch at a time until it would block
+void relay_drain(RelayWorker *worker, int sockfd)
+{
     while (1)
     {
-        FD_ZERO(&readfds);
-        FD_SET(client_socket, &readfds);
-        FD_SET(server_socket, &readfds);
+        for (int i = 0; i < RELAY_BATCH; i++)
+        {
+            worker->rx[i].msg_hdr.msg_namelen = sizeof(worker->rx_addr[i]);
+            worker->rx[i].msg_hdr.msg_flags = 0;
+        }
 
-        int activity = select(max_fd + 1, &readfds, NULL, NULL, NULL);
-        if (activity < 0)
+        int count = recvmmsg(sockfd, worker->rx, RELAY_BATCH, MSG_DONTWAIT, NULL);
+        if (count <= 0)
         {
-            perror("select error");
-            exit(1);
+            if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("Error receiving data");
+            return;
+        }
+        worker->stats.batches++;
+
+        uint64_t now = relay_clock();
+        for (int i = 0; i < count; i++)
+        {
+            if (worker->rx[i].msg_hdr.msg_flags & MSG_TRUNC)
+                worker->stats.dropped++;
+            else
+                relay_process(worker, i, worker->rx[i].msg_len, now);
+        }
+        relay_flush(worker, worker->server_sockfd, &worker->to_server);
+        relay_flush(worker, worker->client_sockfd, &worker->to_client);
+
+        if (count < RELAY_BATCH)
+            return;
+    }
+}
+
+void *relay_worker(void *arg)
+{
+    RelayWorker *worker = arg;
+    struct epoll_event events[2];
+
+    while (1)
+    {
+        int ready = epoll_wait(worker->epfd, events, 2, -1);
+        if (ready < 0)
+        {
+            if (errno != EINTR)
+                perror("epoll_wait error");
+            continue;
         }
+        for (int i = 0; i < ready; i++)
+            relay_drain(worker, events[i].data.fd);
+    }
+    return NULL;
+}
+
+int relay_open_worker(Relay *relay, RelayWorker *worker)
+{
+    int enable = 1;
+    int buffer_size = 4 * 1024 * 1024;
+    struct sockaddr_in upstream_addr;
+    struct epoll_event event;
+
+    worker->relay = relay;
+    worker->client_sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    worker->server_sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    worker->epfd = epoll_create1(0);
+    if (worker->client_sockfd < 0 || worker->server_sockfd < 0 || worker->epfd < 0)
+    {
+        perror("Error creating socket");
+        return -1;
+    }
+
+    setsockopt(worker->client_sockfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+    setsockopt(worker->client_sockfd, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable));
+    setsockopt(worker->client_sockfd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    setsockopt(worker->server_sockfd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+    // The first worker resolves an ephemeral port for the others to share
+    if (bind(worker->client_sockfd, (struct sockaddr *)&relay->address, sizeof(relay->address)) < 0)
+    {
+        perror("Error binding client socket");
+        return -1;
+    }
+    socklen_t len = sizeof(relay->address);
+    getsockname(worker->client_sockfd, (struct sockaddr *)&relay->address, &len);
+
+    // Bound on the relay side so the server sees a stable source address
+    memset(&upstream_addr, 0, sizeof(upstream_addr));
+    upstream_addr.sin_family = AF_INET;
+    upstream_addr.sin_addr = relay->config.listen_ip;
+    if (bind(worker->server_sockfd, (struct sockaddr *)&upstream_addr, sizeof(upstream_addr)) < 0)
+    {
+        perror("Error binding server socket");
+        return -1;
+    }
+
+    event.events = EPOLLIN;
+    event.data.fd = worker->client_sockfd;
+    epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->client_sockfd, &event);
+    event.data.fd = worker->server_sockfd;
+    epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->server_sockfd, &event);
+
+    worker->buffers = malloc(RELAY_BATCH * RELAY_BUFFER_SIZE);
+    for (int i = 0; i < RELAY_BATCH; i++)
+    {
+        worker->rx_iov[i].iov_base = worker->buffers[i];
+        worker->rx_iov[i].iov_len = RELAY_BUFFER_SIZE;
+        worker->rx[i].msg_hdr.msg_iov = &worker->rx_iov[i];
+        worker->rx[i].msg_hdr.msg_iovlen = 1;
+        worker->rx[i].msg_hdr.msg_name = &worker->rx_addr[i];
+    }
+    return 0;
+}
+
+Relay *relay_start(RelayConfig *config)
+{
+    Relay *relay = calloc(1, sizeof(Relay));
+    relay->config = *config;
+    relay->worker_count = config->threads < 1 ? 1 : config->threads > RELAY_MAX_THREADS ? RELAY_MAX_THREADS : config->threads;
+
+    relay->routes = calloc(RELAY_TABLE_BUCKETS, sizeof(RelayBucket));
+    for (int i = 0; i < RELAY_TABLE_BUCKETS; i++)
+        pthread_mutex_init(&relay->routes[i].lock, NULL);
+
+    relay->upstream_count = config->server_count < RELAY_MAX_UPSTREAMS ? config->server_count : RELAY_MAX_UPSTREAMS;
+    if (relay->upstream_count < 1)
+    {
+        fprintf(stderr, "Error: no upstream servers configured\n");
+        return NULL;
+    }
+    for (int i = 0; i < relay->upstream_count; i++)
+        relay->upstreams[i].address = config->servers[i];
+    relay_build_ring(relay);
+
+    // Agent Circuit ID (1) and Agent Remote ID (2) sub-options
+    const char *suboptions[2] = {config->circuit_id, config->remote_id};
+    for (int i = 0; i < 2; i++)
+    {
+        size_t len = strnlen(suboptions[i], sizeof(config->circuit_id));
+        if (len == 0 || relay->agent_option_len + 2 + len > sizeof(relay->agent_option))
+            continue;
+        relay->agent_option[relay->agent_option_len++] = i + 1;
+        relay->agent_option[relay->agent_option_len++] = len;
+        memcpy(&relay->agent_option[relay->agent_option_len], suboptions[i], len);
+        relay->agent_option_len += len;
+    }
+
+    relay->address.sin_family = AF_INET;
+    relay->address.sin_addr = config->listen_ip;
+    relay->address.sin_port = htons(config->listen_port);
+
+    for (int i = 0; i < relay->worker_count; i++)
+    {
+        if (relay_open_worker(relay, &relay->workers[i]) < 0)
+            return NULL;
+    }
+    for (int i = 0; i < relay->worker_count; i++)
+        pthread_create(&relay->workers[i].thread, NULL, relay_worker, &relay->workers[i]);
+    return relay;
+}
 
-        if (FD_ISSET(client_socket, &readfds))
+struct sockaddr_in relay_address(Relay *relay)
+{
+    return relay->address;
+}
+
+void relay_stats(Relay *relay, RelayStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < relay->worker_count; i++)
+    {
+        RelayStats *worker = &relay->workers[i].stats;
+        stats->requests += __atomic_load_n(&worker->requests, __ATOMIC_RELAXED);
+        stats->replies += __atomic_load_n(&worker->replies, __ATOMIC_RELAXED);
+        stats->unroutable += __atomic_load_n(&worker->unroutable, __ATOMIC_RELAXED);
+        stats->dropped += __atomic_load_n(&worker->dropped, __ATOMIC_RELAXED);
+        stats->evictions += __atomic_load_n(&worker->evictions, __ATOMIC_RELAXED);
+        stats->send_errors += __atomic_load_n(&worker->send_errors, __ATOMIC_RELAXED);
+        stats->batches += __atomic_load_n(&worker->batches, __ATOMIC_RELAXED);
+    }
+
+    uint64_t now = relay_clock();
+    stats->upstream_count = relay->upstream_count;
+    for (int u = 0; u < relay->upstream_count; u++)
+    {
+        RelayUpstreamStats *upstream = &stats->upstreams[u];
+        uint64_t latency_total = 0, latency_max = 0;
+        upstream->address = relay->upstreams[u].address;
+        upstream->healthy = relay_upstream_healthy(&relay->upstreams[u], now);
+        for (int i = 0; i < relay->worker_count; i++)
         {
-            relay_dhcp_message(client_socket, server_socket, &client_addr, &server_addr);
+            RelayUpstreamCounters *counters = &relay->workers[i].upstream_stats[u];
+            upstream->requests += __atomic_load_n(&counters->requests, __ATOMIC_RELAXED);
+            upstream->replies += __atomic_load_n(&counters->replies, __ATOMIC_RELAXED);
+            upstream->lost += __atomic_load_n(&counters->lost, __ATOMIC_RELAXED);
+            upstream->failovers += __atomic_load_n(&counters->failovers, __ATOMIC_RELAXED);
+            upstream->send_errors += __atomic_load_n(&counters->send_errors, __ATOMIC_RELAXED);
+            latency_total += __atomic_load_n(&counters->latency_total, __ATOMIC_RELAXED);
+            uint64_t max = __atomic_load_n(&counters->latency_max, __ATOMIC_RELAXED);
+            if (max > latency_max)
+                latency_max = max;
         }
+        upstream->latency_avg_ms = upstream->replies ? latency_total / 1e6 / upstream->replies : 0;
+        upstream->latency_max_ms = latency_max / 1e6;
+    }
+}
+
+#ifndef RELAY_NO_MAIN
+// Without --giaddr, use the local address the kernel picks to reach the
+// server, which is what it would see as the source of our requests
+struct in_addr default_giaddr(RelayConfig *config)
+{
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    memset(&local, 0, sizeof(local));
+    if (config->listen_ip.s_addr != INADDR_ANY)
+        local.sin_addr = config->listen_ip;
+    else if (connect(sockfd, (struct sockaddr *)&config->servers[0], sizeof(config->servers[0])) == 0)
+        getsockname(sockfd, (struct sockaddr *)&local, &len);
+    close(sockfd);
+    return local.sin_addr;
+}
+
+// Parses ip or ip:port
+int parse_server(const char *arg, int default_port, struct sockaddr_in *addr)
+{
+    char ip_str[INET_ADDRSTRLEN];
+    const char *colon = strchr(arg, ':');
+    size_t len = colon ? (size_t)(colon - arg) : strlen(arg);
+    if (len >= sizeof(ip_str))
+        return 0;
+    memcpy(ip_str, arg, len);
+    ip_str[len] = '\0';
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(colon ? atoi(colon + 1) : default_port);
+    return inet_pton(AF_INET, ip_str, &addr->sin_addr) == 1;
+}
+
+int main(int argc, char *argv[])
+{
+    RelayConfig config;
+    const char *servers[RELAY_MAX_UPSTREAMS];
+    const char *giaddr = NULL;
+    int server_port = DHCP_SERVER_PORT;
+    int usage_error = 0;
+    const char *trace_path = NULL;
+    uint32_t trace_sample = 1;
+
+    memset(&config, 0, sizeof(config));
+    config.listen_ip.s_addr = INADDR_ANY;
+    config.listen_port = DHCP_RELAY_PORT;
+    config.threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-q") == 0)
+            config.quiet = 1;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            config.threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--giaddr") == 0 && i + 1 < argc)
+            giaddr = argv[++i];
+        else if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc)
+            usage_error |= inet_pton(AF_INET, argv[++i], &config.listen_ip) != 1;
+        else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+            config.listen_port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--server-port") == 0 && i + 1 < argc)
+            server_port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--circuit-id") == 0 && i + 1 < argc)
+            snprintf(config.circuit_id, sizeof(config.circuit_id), "%s", argv[++i]);
+        else if (strcmp(argv[i], "--remote-id") == 0 && i + 1 < argc)
+            snprintf(config.remote_id, sizeof(config.remote_id), "%s", argv[++i]);
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            trace_path = argv[++i];
+        else if (strcmp(argv[i], "--trace-sample") == 0 && i + 1 < argc)
+            trace_sample = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && config.server_count < RELAY_MAX_UPSTREAMS)
+            servers[config.server_count++] = argv[i];
+        else
+            usage_error = 1;
+    }
 
-        if (FD_ISSET(server_socket, &readfds))
+    for (int i = 0; i < config.server_count; i++)
+        usage_error |= !parse_server(servers[i], server_port, &config.servers[i]);
+    if (config.server_count == 0 || usage_error)
+    {
+        fprintf(stderr, "Usage: %s [-q] [--threads N] [--giaddr ip] [--listen ip] [--port port] [--server-port port] "
+                        "[--circuit-id text] [--remote-id text] [--trace FILE [--trace-sample N]] server_ip[:port]...\n", argv[0]);
+        exit(1);
+    }
+    if (giaddr)
+    {
+        if (inet_pton(AF_INET, giaddr, &config.giaddr) != 1)
         {
-            relay_dhcp_message(server_socket, client_socket, &server_addr, &client_addr);
+            fprintf(stderr, "Error: invalid relay address %s\n", giaddr);
+            exit(1);
         }
     }
+    else
+    {
+        config.giaddr = default_giaddr(&config);
+    }
+
+    // Option 82 defaults: the link clients are on and the relay itself
+    char ip_str[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &config.giaddr, ip_str, sizeof(ip_str));
+    if (config.circuit_id[0] == '\0')
+        snprintf(config.circuit_id, sizeof(config.circuit_id), "%s", ip_str);
+    if (config.remote_id[0] == '\0')
+        gethostname(config.remote_id, sizeof(config.remote_id) - 1);
+
+    if (trace_path && trace_start(trace_path, "relay", trace_sample) < 0)
+        exit(1);
+
+    Relay *relay = relay_start(&config);
+    if (!relay)
+        exit(1);
+
+    printf("DHCP Relay is running with %d threads and %d servers, giaddr %s...\n", relay->worker_count, config.server_count, ip_str);
 
-    close(client_socket);
-    close(server_socket);
+    while (1)
+    {
+        sleep(RELAY_STATS_INTERVAL);
+        if (config.quiet)
+            continue;
+
+        RelayStats stats;
+        relay_stats(relay, &stats);
+        printf("--- Relay: %lu requests, %lu replies, %lu unroutable, %lu dropped, %lu evictions, %lu send errors ---\n",
+               stats.requests, stats.replies, stats.unroutable, stats.dropped, stats.evictions, stats.send_errors);
+        for (int i = 0; i < stats.upstream_count; i++)
+        {
+            RelayUpstreamStats *upstream = &stats.upstreams[i];
+            inet_ntop(AF_INET, &upstream->address.sin_addr, ip_str, sizeof(ip_str));
+            printf("Server %s:%d %s: %lu requests, %lu replies, %lu lost, %lu failovers, %lu send errors, latency %.3f ms avg %.3f ms max\n",
+                   ip_str, ntohs(upstream->address.sin_port), upstream->healthy ? "up" : "DOWN",
+                   upstream->requests, upstream->replies, upstream->lost, upstream->failovers, upstream->send_errors,
+                   upstream->latency_avg_ms, upstream->latency_max_ms);
+        }
+        trace_print_stats();
+    }
     return 0;
 }
+#endif
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <poll.h>
+#include "dhcp.h"
+#include "capture.h"
+
+#define BUFFER_SIZE 1024
+#define DHCP_SERVER_PORT 67
+#define DEFAULT_WINDOW 64    // Requests in flight when replaying as fast as possible
+#define DEFAULT_TIMEOUT 500 // Milliseconds to wait for a reply
+
+// Replays the DHCP requests of a pcap capture against a running server over
+// UDP, either at the recorded inter-arrival times or as fast as possible, and
+// checks every reply against the one recorded in the capture.
+
+typedef struct
+{
+    size_t index; // Request in the trace
+    double sent;  // Monotonic time it was sent
+} Outstanding;
+
+typedef struct
+{
+    uint8_t used;
+    uint8_t chaddr[16];
+    uint32_t ip; // 0 once released
+} Binding;
+
+ReplayTrace trace;
+ReplayStats stats;
+Outstanding *outstanding;
+int outstanding_count = 0;
+Binding *bindings;
+size_t binding_capacity = 1024;
+size_t binding_count = 0;
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+uint32_t hash_chaddr(uint8_t *chaddr)
+{
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (int i = 0; i < 16; i++)
+        hash = (hash ^ chaddr[i]) * 16777619u;
+    return hash;
+}
+
+// Open addressing table of the bindings the server acknowledged
+Binding *find_binding(uint8_t *chaddr)
+{
+    if (binding_count * 2 >= binding_capacity)
+    {
+        Binding *old = bindings;
+        size_t old_capacity = binding_capacity;
+        binding_capacity *= 2;
+        bindings = calloc(binding_capacity, sizeof(Binding));
+        binding_count = 0;
+        for (size_t i = 0; i < old_capacity; i++)
+        {
+            if (old[i].used)
+            {
+                *find_binding(old[i].chaddr) = old[i];
+                binding_count++;
+            }
+        }
+        free(old);
+    }
+
+    size_t slot = hash_chaddr(chaddr) & (binding_capacity - 1);
+    while (bindings[slot].used && memcmp(bindings[slot].chaddr, chaddr, 16) != 0)
+        slot = (slot + 1) & (binding_capacity - 1);
+    return &bindings[slot];
+}
+
+void track_binding(DHCPMessage *msg, size_t len)
+{
+    DHCPOptions opts;
+    if (!dhcp_index_options(msg, len, &opts))
+        return;
+
+    if (opts.message_type == DHCPACK && msg->yiaddr)
+    {
+        Binding *binding = find_binding(msg->chaddr);
+        if (!binding->used)
+        {
+            binding->used = 1;
+            memcpy(binding->chaddr, msg->chaddr, 16);
+            binding_count++;
+        }
+        binding->ip = msg->yiaddr;
+    }
+}
+
+void forget_binding(DHCPMessage *msg)
+{
+    Binding *binding = find_binding(msg->chaddr);
+    binding->ip = 0; // Slots stay claimed, the table is only ever grown
+}
+
+void complete(int slot)
+{
+    outstanding[slot] = outstanding[--outstanding_count];
+}
+
+// Waits up to timeout_ms for replies and matches them to requests in flight
+void receive_replies(int sockfd, int timeout_ms)
+{
+    char buffer[BUFFER_SIZE];
+    struct pollfd pfd = {sockfd, POLLIN, 0};
+
+    while (poll(&pfd, 1, timeout_ms) > 0)
+    {
+        ssize_t recv_len = recv(sockfd, buffer, BUFFER_SIZE, 0);
+        if (recv_len < 0)
+        {
+            perror("Error receiving data");
+            return;
+        }
+
+        DHCPMessage *reply = (DHCPMessage *)buffer;
+        int slot;
+        for (slot = 0; slot < outstanding_count; slot++)
+        {
+            DHCPMessage *request = &trace.requests[outstanding[slot].index].msg;
+            if (request->xid == reply->xid && memcmp(request->chaddr, reply->chaddr, 16) == 0)
+                break;
+        }
+        if (slot == outstanding_count)
+        {
+            stats.replies++;
+            stats.unexpected++; // Late or unsolicited
+        }
+        else
+        {
+            capture_check_reply(&trace, &stats, outstanding[slot].index, reply, recv_len);
+            complete(slot);
+        }
+        track_binding(reply, recv_len);
+        timeout_ms = 0; // Drain what is queued, then return
+    }
+}
+
+void expire_outstanding(double timeout)
+{
+    double current = now();
+    for (int slot = 0; slot < outstanding_count; slot++)
+    {
+        if (current - outstanding[slot].sent >= timeout)
+        {
+            capture_check_no_reply(&trace, &stats, outstanding[slot].index);
+            complete(slot--);
+        }
+    }
+}
+
+int has_outstanding(uint8_t *chaddr)
+{
+    for (int slot = 0; slot < outstanding_count; slot++)
+    {
+        if (memcmp(trace.requests[outstanding[slot].index].msg.chaddr, chaddr, 16) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = NULL;
+    const char *host = "127.0.0.1";
+    int port = DHCP_SERVER_PORT;
+    int realtime = 0;
+    int window = DEFAULT_WINDOW;
+    int timeout_ms = DEFAULT_TIMEOUT;
+    char *positional[3];
+    int positional_count = 0;
+    int usage_error = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--realtime") == 0)
+            realtime = 1;
+        else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc)
+            window = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)
+            timeout_ms = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && positional_count < 3)
+            positional[positional_count++] = argv[i];
+        else
+            usage_error = 1;
+    }
+    if (positional_count > 0)
+        path = positional[0];
+    if (positional_count > 1)
+        host = positional[1];
+    if (positional_count > 2)
+        port = atoi(positional[2]);
+    if (!path || usage_error || window < 1)
+    {
+        fprintf(stderr, "Usage: %s [--realtime] [--window N] [--timeout ms] capture.pcap [server_ip [port]]\n", argv[0]);
+        exit(1);
+    }
+
+    if (capture_load(path, &trace) < 0)
+        exit(1);
+
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0)
+    {
+        perror("Error creating socket");
+        exit(1);
+    }
+    int buffer_size = 4 * 1024 * 1024;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &server_addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "Error: invalid server address %s\n", host);
+        exit(1);
+    }
+
+    outstanding = calloc(window, sizeof(Outstanding));
+    bindings = calloc(binding_capacity, sizeof(Binding));
+    double timeout = timeout_ms / 1000.0;
+
+    printf("Replaying to %s:%d %s\n", host, port, realtime ? "at the recorded pace" : "as fast as possible");
+    double start = now();
+    for (size_t i = 0; i < trace.request_count; i++)
+    {
+        CapturedRequest *request = &trace.requests[i];
+
+        if (realtime)
+        {
+            double wait;
+            while ((wait = start + request->timestamp - now()) > 0)
+            {
+                receive_replies(sockfd, (int)(wait * 1000));
+                expire_outstanding(timeout);
+            }
+        }
+
+        // Keep each client's exchange in order and the window bounded
+        while (outstanding_count == window || has_outstanding(request->msg.chaddr))
+        {
+            receive_replies(sockfd, 1);
+            expire_outstanding(timeout);
+        }
+
+        if (sendto(sockfd, &request->msg, request->length, 0, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+        {
+            perror("Error sending data");
+            continue;
+        }
+        stats.messages++;
+
+        DHCPOptions opts;
+        dhcp_index_options(&request->msg, request->length, &opts);
+        if (opts.message_type == DHCPRELEASE || opts.message_type == DHCPDECLINE)
+        {
+            forget_binding(&request->msg);
+            capture_check_no_reply(&trace, &stats, i);
+            continue;
+        }
+        outstanding[outstanding_count].index = i;
+        outstanding[outstanding_count].sent = now();
+        outstanding_count++;
+
+        receive_replies(sockfd, 0);
+    }
+    while (outstanding_count > 0)
+    {
+        receive_replies(sockfd, 10);
+        expire_outstanding(timeout);
+    }
+    stats.elapsed = now() - start;
+
+    capture_print_report(&stats);
+
+    size_t bound = 0;
+    printf("\n--- Acknowledged Bindings ---\n");
+    for (size_t i = 0; i < binding_capacity; i++)
+    {
+        if (!bindings[i].ip)
+            continue;
+        struct in_addr ip = {bindings[i].ip};
+        if (bound++ < 20)
+            printf("IP: %s, MAC: %02x:%02x:%02x:%02x:%02x:%02x\n", inet_ntoa(ip),
+                   bindings[i].chaddr[0], bindings[i].chaddr[1], bindings[i].chaddr[2],
+                   bindings[i].chaddr[3], bindings[i].chaddr[4], bindings[i].chaddr[5]);
+    }
+    printf("%zu bindings held at the end of the replay\n", bound);
+    printf("-----------------------------\n");
+
+    close(sockfd);
+    capture_free(&trace);
+    return stats.mismatched || stats.missing || stats.unexpected ? 2 : 0;
+}
@@ -6,42 +6,33 @@
 #include <time.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <linux/sock_diag.h>
+#include "server.h"
+#include "capture.h"
 
 #define BUFFER_SIZE 1024
-#define DHCP_SERVER_PORT 67
 #define CIDR_NOTATION "192.17.0.1/32"
 #define LEASE_TIME 20 // 5 seconds for testing purposes
 #define DNS_SERVER "8.8.8.8"
+#define HARDWARE_TYPE 1 // Ethernet clients only, checked in the kernel filter
+#define HARDWARE_LEN 6
 
-typedef struct
-{
-    uint8_t op;
-    uint8_t htype;
-    uint8_t hlen;
-    uint8_t hops;
-    uint32_t xid;
-    uint16_t secs;
-    uint16_t flags;
-    uint32_t ciaddr;
-    uint32_t yiaddr;
-    uint32_t siaddr;
-    uint32_t giaddr;
-    uint8_t chaddr[16];
-    uint8_t sname[64];
-    uint8_t file[128];
-    uint8_t options[312];
-} DHCPMessage;
-
-typedef struct
-{
-    struct in_addr ip;
-    time_t lease_start;
-    time_t lease_expiration;
-    uint8_t chaddr[16];
-} IPLease;
+// Lease time policy: long leases while the pool is mostly empty, shrinking
+// linearly down to LEASE_TIME as utilization climbs towards the high mark
+#define LEASE_TIME_MAX 3600
+#define LEASE_UTIL_LOW 50  // percent, at or below this the max lease is used
+#define LEASE_UTIL_HIGH 90 // percent, at or above this the min lease is used
+#define LEASE_JITTER 10    // percent of jitter applied to T1/T2
 
-IPLease ip_leases[256];
+IPLease ip_leases[MAX_LEASES];
 int lease_count = 0;
+uint32_t lease_slots = 0; // Slots handed out to pools so far
+
+AddressPool pools[MAX_POOLS];
+int pool_count = 0;
 
 struct in_addr network_address;
 struct in_addr subnet_mask;
@@ -53,6 +44,25 @@ struct in_addr ip_range_end;
 // Agregar un mutex global para proteger el acceso a recursos compartidos
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// Set by -q to silence the per-packet log lines
+int quiet = 0;
+int stats_sockfd = -1;
+uint64_t packet_drops = 0; // PACKET_STATISTICS resets on every read
+UringEngine *stats_uring = NULL; // Engine picked with --io, for the stats printout
+PacketEngine *stats_packet = NULL;
+
+ssize_t send_reply(ReplySink *sink, DHCPMessage *reply, struct sockaddr_in *dest)
+{
+    ssize_t sent = sizeof(*reply);
+    trace_point(TRACE_ENCODED, reply->xid, reply->chaddr);
+    if (sink->deliver)
+        sink->deliver(sink->arg, reply, dest);
+    else
+        sent = sendto(sink->sockfd, reply, sizeof(*reply), 0, (struct sockaddr *)dest, sizeof(*dest));
+    trace_point(TRACE_SENT, reply->xid, reply->chaddr);
+    return sent;
+}
+
 void initialize_network()
 {
     char ip_str[16];
@@ -86,54 +96,164 @@ void initialize_network()
     printf("IP Range End: %s\n", inet_ntoa(ip_range_end));
 }
 
-int is_ip_in_range(struct in_addr ip)
+AddressPool *find_pool(struct in_addr ip)
+{
+    for (int i = 0; i < pool_count; i++)
+    {
+        if (ntohl(ip.s_addr) >= ntohl(pools[i].range_start.s_addr) && ntohl(ip.s_addr) <= ntohl(pools[i].range_end.s_addr))
+            return &pools[i];
+    }
+    return NULL;
+}
+
+uint32_t pool_size(AddressPool *pool)
 {
-    return (ntohl(ip.s_addr) >= ntohl(ip_range_start.s_addr) && ntohl(ip.s_addr) <= ntohl(ip_range_end.s_addr));
+    return ntohl(pool->range_end.s_addr) - ntohl(pool->range_start.s_addr) + 1;
 }
 
-struct in_addr get_available_ip()
+uint32_t pool_utilization(AddressPool *pool)
 {
-    struct in_addr ip = ip_range_start;
-    for (uint32_t i = 0; i <= ntohl(ip_range_end.s_addr) - ntohl(ip_range_start.s_addr); i++)
+    return __atomic_load_n(&pool->active, __ATOMIC_RELAXED) * 100 / pool_size(pool);
+}
+
+// Pools are fixed after startup, so this needs no locking
+IPLease *find_lease_slot(struct in_addr ip)
+{
+    AddressPool *pool = find_pool(ip);
+    if (!pool)
+        return NULL;
+    return &ip_leases[pool->slot_base + ntohl(ip.s_addr) - ntohl(pool->range_start.s_addr)];
+}
+
+// Seqlock write side, callers hold the mutex
+void lease_write_begin(IPLease *lease)
+{
+    __atomic_store_n(&lease->seq, lease->seq + 1, __ATOMIC_SEQ_CST);
+}
+
+void lease_write_end(IPLease *lease)
+{
+    __atomic_store_n(&lease->seq, lease->seq + 1, __ATOMIC_RELEASE);
+}
+
+void bind_lease(IPLease *lease, struct in_addr ip, uint8_t *chaddr, uint32_t relay, uint32_t lease_time, uint32_t renew_time)
+{
+    lease_write_begin(lease);
+    lease->ip = ip;
+    lease->relay.s_addr = relay;
+    lease->lease_start = time(NULL);
+    __atomic_store_n(&lease->lease_expiration, lease->lease_start + lease_time, __ATOMIC_SEQ_CST);
+    lease->renew_time = renew_time;
+    memcpy(lease->chaddr, chaddr, 16);
+    lease_write_end(lease);
+    lease_count++;
+    __atomic_fetch_add(&find_pool(ip)->active, 1, __ATOMIC_RELAXED);
+    lease_event(LEASE_EVENT_COMMIT, ip.s_addr, chaddr, relay, lease_time);
+}
+
+// Consistent copy of a slot without the mutex, retried while a writer is
+// in the middle of it. Returns 1 if the slot holds a binding
+int lease_read(IPLease *lease, IPLease *copy)
+{
+    while (1)
     {
-        ip.s_addr = htonl(ntohl(ip_range_start.s_addr) + i);
-        int available = 1;
-        for (int j = 0; j < lease_count; j++)
+        uint32_t seq = __atomic_load_n(&lease->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
         {
-            if (ip_leases[j].ip.s_addr == ip.s_addr)
-            {
-                available = 0;
-                break;
-            }
+            sched_yield(); // Let the writer finish
+            continue;
         }
-        if (available)
-            return ip;
+        memcpy(copy, lease, sizeof(*copy));
+        copy->lease_expiration = __atomic_load_n(&lease->lease_expiration, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&lease->seq, __ATOMIC_RELAXED) == seq)
+            return copy->ip.s_addr != 0;
     }
-    ip.s_addr = INADDR_NONE;
-    return ip;
 }
 
-void handle_dhcp_discover(int sockfd, DHCPMessage *msg, struct sockaddr_in *client_addr)
+// Must be called between lease_write_begin and lease_write_end
+void clear_lease(IPLease *lease)
 {
-    struct in_addr available_ip = get_available_ip();
-    if (available_ip.s_addr == INADDR_NONE)
+    AddressPool *pool = find_pool(lease->ip);
+    lease->ip.s_addr = 0;
+    __atomic_store_n(&lease->lease_expiration, 0, __ATOMIC_SEQ_CST);
+    memset(lease->chaddr, 0, 16);
+    lease_count--;
+    __atomic_fetch_sub(&pool->active, 1, __ATOMIC_RELAXED);
+}
+
+void unbind_lease(IPLease *lease)
+{
+    lease_write_begin(lease);
+    clear_lease(lease);
+    lease_write_end(lease);
+}
+
+// Cheap per-thread PRNG for lease jitter, no need for rand()'s global state
+uint32_t next_random()
+{
+    static __thread uint32_t state = 0;
+    if (state == 0)
+        state = (uint32_t)time(NULL) ^ (uint32_t)pthread_self() ^ 0x9e3779b9;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Apply +/- jitter percent to a value
+uint32_t jitter_time(uint32_t value, uint8_t jitter)
+{
+    uint32_t spread = value * jitter / 100;
+    if (spread == 0)
+        return value;
+    return value - spread + next_random() % (2 * spread + 1);
+}
+
+LeaseTimes compute_lease_times(AddressPool *pool)
+{
+    LeasePolicy *policy = &pool->policy;
+    uint32_t utilization = pool_utilization(pool);
+    LeaseTimes times;
+
+    if (utilization <= policy->util_low)
     {
-        printf("No available IP addresses\n");
-        return;
+        times.lease_time = policy->max_lease;
+    }
+    else if (utilization >= policy->util_high)
+    {
+        times.lease_time = policy->min_lease;
+    }
+    else
+    {
+        uint32_t range = policy->max_lease - policy->min_lease;
+        times.lease_time = policy->max_lease - range * (utilization - policy->util_low) / (policy->util_high - policy->util_low);
     }
 
-    DHCPMessage offer_msg;
-    memset(&offer_msg, 0, sizeof(offer_msg));
-    offer_msg.op = 2; // BOOTREPLY
-    offer_msg.htype = msg->htype;
-    offer_msg.hlen = msg->hlen;
-    offer_msg.xid = msg->xid;
-    memcpy(offer_msg.chaddr, msg->chaddr, 16);
-    offer_msg.yiaddr = available_ip.s_addr;
-    offer_msg.flags = htons(0x8000); // Broadcast flag
-
-    // Set DHCP options
-    uint8_t *options = offer_msg.options;
+    // RFC 2131 defaults (0.5 and 0.875 of the lease), jittered so that
+    // clients bound at the same time do not renew in lockstep
+    times.renewal_time = jitter_time(times.lease_time / 2, policy->jitter);
+    times.rebinding_time = jitter_time(times.lease_time * 7 / 8, policy->jitter);
+    if (times.rebinding_time >= times.lease_time)
+        times.rebinding_time = times.lease_time - 1;
+    if (times.renewal_time >= times.rebinding_time)
+        times.renewal_time = times.rebinding_time - 1;
+    if (times.renewal_time == 0)
+        times.renewal_time = 1;
+    return times;
+}
+
+// Only for leases actually bound or renewed, offers are not counted.
+// Also called from the lock-free renewal path
+void count_lease(AddressPool *pool, LeaseTimes *times)
+{
+    __atomic_fetch_add(&pool->leases_granted, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&pool->lease_time_total, times->lease_time, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool->last_lease_time, times->lease_time, __ATOMIC_RELAXED);
+}
+
+void set_reply_options(uint8_t *options, uint8_t message_type, LeaseTimes *times)
+{
     options[0] = 0x63; // Magic cookie
     options[1] = 0x82;
     options[2] = 0x53;
@@ -141,28 +261,147 @@ void handle_dhcp_discover(int sockfd, DHCPMessage *msg, struct sockaddr_in *clie
 
     options[4] = 53; // DHCP Message Type
     options[5] = 1;  // Length
-    options[6] = 2;  // DHCPOFFER
+    options[6] = message_type;
 
     options[7] = 51; // IP Address Lease Time
     options[8] = 4;  // Length
-    uint32_t lease_time = htonl(LEASE_TIME);
+    uint32_t lease_time = htonl(times->lease_time);
     memcpy(&options[9], &lease_time, 4);
 
-    options[13] = 1; // Subnet Mask
-    options[14] = 4; // Length
-    memcpy(&options[15], &subnet_mask, 4);
+    options[13] = 58; // Renewal (T1) Time
+    options[14] = 4;  // Length
+    uint32_t renewal_time = htonl(times->renewal_time);
+    memcpy(&options[15], &renewal_time, 4);
 
-    options[19] = 6; // DNS Server
-    options[20] = 4; // Length
+    options[19] = 59; // Rebinding (T2) Time
+    options[20] = 4;  // Length
+    uint32_t rebinding_time = htonl(times->rebinding_time);
+    memcpy(&options[21], &rebinding_time, 4);
+
+    options[25] = 1; // Subnet Mask
+    options[26] = 4; // Length
+    memcpy(&options[27], &subnet_mask, 4);
+
+    options[31] = 6; // DNS Server
+    options[32] = 4; // Length
     struct in_addr dns_server;
     inet_aton(DNS_SERVER, &dns_server);
-    memcpy(&options[21], &dns_server, 4);
+    memcpy(&options[33], &dns_server, 4);
 
-    options[25] = 3; // Router (Default Gateway)
-    options[26] = 4; // Length
-    memcpy(&options[27], &default_gateway, 4);
+    options[37] = 3; // Router (Default Gateway)
+    options[38] = 4; // Length
+    memcpy(&options[39], &default_gateway, 4);
 
-    options[31] = 255; // End option
+    options[43] = 255; // End option
+}
+
+// Replies only differ in the client fields and lease times, so each pool keeps
+// prebuilt OFFER/ACK messages that are copied and patched per packet
+void init_reply_templates(AddressPool *pool)
+{
+    LeaseTimes times = {0, 0, 0};
+
+    memset(&pool->offer_template, 0, sizeof(DHCPMessage));
+    pool->offer_template.op = 2;                   // BOOTREPLY
+    pool->offer_template.flags = htons(0x8000); // Broadcast flag
+    set_reply_options(pool->offer_template.options, 2, &times); // DHCPOFFER
+
+    memset(&pool->ack_template, 0, sizeof(DHCPMessage));
+    pool->ack_template.op = 2; // BOOTREPLY
+    set_reply_options(pool->ack_template.options, 5, &times); // DHCPACK
+}
+
+AddressPool *add_pool(struct in_addr range_start, struct in_addr range_end)
+{
+    AddressPool *pool = &pools[pool_count++];
+    memset(pool, 0, sizeof(*pool));
+    pool->range_start = range_start;
+    pool->range_end = range_end;
+    pool->policy.min_lease = LEASE_TIME;
+    pool->policy.max_lease = LEASE_TIME_MAX;
+    pool->policy.util_low = LEASE_UTIL_LOW;
+    pool->policy.util_high = LEASE_UTIL_HIGH;
+    pool->policy.jitter = LEASE_JITTER;
+    pool->slot_base = lease_slots;
+    lease_slots += pool_size(pool);
+    if (lease_slots > MAX_LEASES)
+    {
+        fprintf(stderr, "Error: address pools exceed %d leases.\n", MAX_LEASES);
+        exit(1);
+    }
+    init_reply_templates(pool);
+    LOG("Lease Time: %u-%u seconds\n", pool->policy.min_lease, pool->policy.max_lease);
+    return pool;
+}
+
+void build_reply(DHCPMessage *reply, DHCPMessage *template, DHCPMessage *msg, uint32_t yiaddr, LeaseTimes *times)
+{
+    memcpy(reply, template, sizeof(DHCPMessage));
+    reply->htype = msg->htype;
+    reply->hlen = msg->hlen;
+    reply->xid = msg->xid;
+    memcpy(reply->chaddr, msg->chaddr, 16);
+    reply->yiaddr = yiaddr;
+
+    uint32_t lease_time = htonl(times->lease_time);
+    uint32_t renewal_time = htonl(times->renewal_time);
+    uint32_t rebinding_time = htonl(times->rebinding_time);
+    memcpy(&reply->options[9], &lease_time, 4);
+    memcpy(&reply->options[15], &renewal_time, 4);
+    memcpy(&reply->options[21], &rebinding_time, 4);
+}
+
+int is_ip_in_range(struct in_addr ip)
+{
+    return find_pool(ip) != NULL;
+}
+
+// A class with its own pool only gets addresses from it, and nobody else does
+int class_may_use(ClientClass *cls, AddressPool *pool)
+{
+    return (pool->reserved ? pool : NULL) == (cls ? cls->pool : NULL);
+}
+
+struct in_addr get_available_ip(AddressPool *only)
+{
+    struct in_addr ip;
+    if (probing_enabled)
+        return probe_take(only); // Only addresses the prober has just checked
+
+    for (int p = 0; p < pool_count; p++)
+    {
+        AddressPool *pool = &pools[p];
+        if (only ? pool != only : pool->reserved)
+            continue;
+        for (uint32_t i = 0; i < pool_size(pool); i++)
+        {
+            uint32_t slot = pool->slot_base + i;
+            if (ip_leases[slot].ip.s_addr == 0 && !probe_quarantined(slot) && (!cluster_enabled || cluster_may_allocate(slot)))
+            {
+                ip.s_addr = htonl(ntohl(pool->range_start.s_addr) + i);
+                return ip;
+            }
+        }
+    }
+    ip.s_addr = INADDR_NONE;
+    return ip;
+}
+
+void handle_dhcp_discover(ReplySink *sink, DHCPMessage *msg, ClientClass *cls, struct sockaddr_in *client_addr)
+{
+    struct in_addr available_ip = get_available_ip(cls ? cls->pool : NULL);
+    if (available_ip.s_addr == INADDR_NONE)
+    {
+        LOG("No available IP addresses\n");
+        return;
+    }
+    trace_point(TRACE_DECIDED, msg->xid, msg->chaddr);
+
+    AddressPool *pool = find_pool(available_ip);
+    LeaseTimes times = compute_lease_times(pool);
+
+    DHCPMessage offer_msg;
+    build_reply(&offer_msg, cls ? &cls->offer_template : &pool->offer_template, msg, available_ip.s_addr, &times);
 
     struct sockaddr_in dest_addr;
     memset(&dest_addr, 0, sizeof(dest_addr));
@@ -170,7 +409,7 @@ void handle_dhcp_discover(int sockfd, DHCPMessage *msg, struct sockaddr_in *clie
     dest_addr.sin_port = client_addr->sin_port;
     dest_addr.sin_addr = client_addr->sin_addr;
 
-    ssize_t sent_len = sendto(sockfd, &offer_msg, sizeof(offer_msg), 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+    ssize_t sent_len = send_reply(sink, &offer_msg, &dest_addr);
 
     if (sent_len < 0)
     {
@@ -178,77 +417,45 @@ void handle_dhcp_discover(int sockfd, DHCPMessage *msg, struct sockaddr_in *clie
     }
     else
     {
-        printf("Sent DHCP OFFER to %s\n", inet_ntoa(dest_addr.sin_addr));
+        LOG("Sent DHCP OFFER to %s\n", inet_ntoa(dest_addr.sin_addr));
     }
 }
 
-void handle_dhcp_request(int sockfd, DHCPMessage *msg, struct sockaddr_in *client_addr)
+void handle_dhcp_request(ReplySink *sink, DHCPMessage *msg, DHCPOptions *opts, ClientClass *cls, struct sockaddr_in *client_addr)
 {
+    // Requested IP Address (option 50), older clients of ours only set yiaddr
     struct in_addr requested_ip;
-    requested_ip.s_addr = msg->yiaddr;
+    requested_ip.s_addr = dhcp_get_option_addr(msg, opts, 50);
+    if (requested_ip.s_addr == 0)
+        requested_ip.s_addr = msg->yiaddr;
 
     if (!is_ip_in_range(requested_ip))
     {
-        printf("Requested IP out of range %s\n", inet_ntoa(requested_ip));
+        LOG("Requested IP out of range %s\n", inet_ntoa(requested_ip));
         return;
     }
 
-    for (int i = 0; i < lease_count; i++)
+    AddressPool *pool = find_pool(requested_ip);
+    if (!class_may_use(cls, pool))
     {
-        if (ip_leases[i].ip.s_addr == requested_ip.s_addr)
-        {
-            printf("IP already leased\n");
-            return;
-        }
+        LOG("Requested IP %s not in the client's class pool\n", inet_ntoa(requested_ip));
+        return;
     }
 
-    ip_leases[lease_count].ip = requested_ip;
-    ip_leases[lease_count].lease_start = time(NULL);
-    ip_leases[lease_count].lease_expiration = time(NULL) + LEASE_TIME;
-    memcpy(ip_leases[lease_count].chaddr, msg->chaddr, 16);
-    lease_count++;
-
-    DHCPMessage ack_msg;
-    memset(&ack_msg, 0, sizeof(ack_msg));
-    ack_msg.op = 2; // BOOTREPLY
-    ack_msg.htype = msg->htype;
-    ack_msg.hlen = msg->hlen;
-    ack_msg.xid = msg->xid;
-    memcpy(ack_msg.chaddr, msg->chaddr, 16);
-    ack_msg.yiaddr = requested_ip.s_addr;
-
-    // Set DHCP options
-    uint8_t *options = ack_msg.options;
-    bzero(options, sizeof(ack_msg.options));
-    options[0] = 0x63; // Magic cookie
-    options[1] = 0x82;
-    options[2] = 0x53;
-    options[3] = 0x63;
-
-    options[4] = 53; // DHCP Message Type
-    options[5] = 1;  // Length
-    options[6] = 5;  // DHCPACK
-
-    options[7] = 51; // IP Address Lease Time
-    options[8] = 4;  // Length
-    uint32_t lease_time = htonl(LEASE_TIME);
-    memcpy(&options[9], &lease_time, 4);
-
-    options[13] = 1; // Subnet Mask
-    options[14] = 4; // Length
-    memcpy(&options[15], &subnet_mask, 4);
-
-    options[19] = 6; // DNS Server
-    options[20] = 4; // Length
-    struct in_addr dns_server;
-    inet_aton(DNS_SERVER, &dns_server);
-    memcpy(&options[21], &dns_server, 4);
+    IPLease *lease = find_lease_slot(requested_ip);
+    if (lease->ip.s_addr != 0)
+    {
+        LOG("IP already leased\n");
+        return;
+    }
 
-    options[25] = 3; // Router (Default Gateway)
-    options[26] = 4; // Length
-    memcpy(&options[27], &default_gateway, 4);
+    LeaseTimes times = compute_lease_times(pool);
+    bind_lease(lease, requested_ip, msg->chaddr, msg->giaddr, times.lease_time, times.renewal_time);
+    count_lease(pool, &times);
+    trace_point(TRACE_DECIDED, msg->xid, msg->chaddr);
 
-    options[31] = 255; // End option
+    DHCPMessage ack_msg;
+    build_reply(&ack_msg, cls ? &cls->ack_template : &pool->ack_template, msg, requested_ip.s_addr, &times);
 
     struct sockaddr_in dest_addr;
     memset(&dest_addr, 0, sizeof(dest_addr));
@@ -256,8 +463,8 @@ void handle_dhcp_request(int sockfd, DHCPMessage *msg, struct sockaddr_in *clien
     dest_addr.sin_port = client_addr->sin_port;
     dest_addr.sin_addr = client_addr->sin_addr;
 
-    sendto(sockfd, &ack_msg, sizeof(ack_msg), 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-    printf("Sent DHCP ACK to %s\n", inet_ntoa(dest_addr.sin_addr));
+    send_reply(sink, &ack_msg, &dest_addr);
+    LOG("Sent DHCP ACK to %s\n", inet_ntoa(dest_addr.sin_addr));
 }
 
 void handle_dhcp_release(DHCPMessage *msg)
@@ -265,158 +472,350 @@ void handle_dhcp_release(DHCPMessage *msg)
     struct in_addr released_ip;
     released_ip.s_addr = msg->yiaddr;
 
-    printf("Releasing IP: %s\n", inet_ntoa(released_ip));
+    LOG("Releasing IP: %s\n", inet_ntoa(released_ip));
 
-    for (int i = 0; i < lease_count; i++)
+    IPLease *lease = find_lease_slot(released_ip);
+    if (lease && lease->ip.s_addr == released_ip.s_addr && memcmp(lease->chaddr, msg->chaddr, 16) == 0)
     {
-        if (ip_leases[i].ip.s_addr == released_ip.s_addr && memcmp(ip_leases[i].chaddr, msg->chaddr, 16) == 0)
-        {
-            printf("Releasing IP: %s\n", inet_ntoa(released_ip));
-            // Shift remaining leases down
-            for (int j = i; j < lease_count - 1; j++)
-            {
-                ip_leases[j] = ip_leases[j + 1];
-            }
-            lease_count--;
-            pthread_mutex_unlock(&mutex);
-            return;
-        }
+        lease_event(LEASE_EVENT_RELEASE, lease->ip.s_addr, lease->chaddr, lease->relay.s_addr, 0);
+        unbind_lease(lease);
+        return;
     }
-    pthread_mutex_unlock(&mutex);
-    printf("IP not found for release: %s\n", inet_ntoa(released_ip));
+    LOG("IP not found for release: %s\n", inet_ntoa(released_ip));
+}
+
+// The client found the address in use: drop its binding and keep the
+// address out of both allocators for a while
+void handle_dhcp_decline(DHCPMessage *msg, DHCPOptions *opts)
+{
+    struct in_addr declined_ip;
+    declined_ip.s_addr = dhcp_get_option_addr(msg, opts, 50);
+
+    IPLease *lease = find_lease_slot(declined_ip);
+    if (!lease)
+        return;
+    LOG("Address declined: %s\n", inet_ntoa(declined_ip));
+    if (lease->ip.s_addr == declined_ip.s_addr && memcmp(lease->chaddr, msg->chaddr, 16) == 0)
+    {
+        lease_event(LEASE_EVENT_DECLINE, lease->ip.s_addr, lease->chaddr, lease->relay.s_addr, 0);
+        unbind_lease(lease);
+    }
+    probe_quarantine(declined_ip);
 }
 
-void handle_dhcp_renew(int sockfd, DHCPMessage *msg, struct sockaddr_in *client_addr)
+// Renewals only push out the expiration of an existing binding, so they are
+// served without the mutex: the slot is read optimistically under its seqlock,
+// the new expiration is published with a CAS and the ACK is built from the
+// pool template. Returns 0 when the binding could not be verified, in which
+// case the caller falls back to handle_dhcp_renew under the mutex.
+int handle_dhcp_renew_fast(ReplySink *sink, DHCPMessage *msg, ClientClass *cls, struct sockaddr_in *client_addr)
+{
+    struct in_addr client_ip;
+    client_ip.s_addr = msg->ciaddr;
+
+    AddressPool *pool = find_pool(client_ip);
+    if (!pool || !class_may_use(cls, pool))
+        return 0;
+    IPLease *lease = &ip_leases[pool->slot_base + ntohl(client_ip.s_addr) - ntohl(pool->range_start.s_addr)];
+
+    uint32_t seq = __atomic_load_n(&lease->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+        return 0; // Writer in progress
+    uint32_t bound_ip = __atomic_load_n(&lease->ip.s_addr, __ATOMIC_RELAXED);
+    time_t expiration = __atomic_load_n(&lease->lease_expiration, __ATOMIC_RELAXED);
+    int match = bound_ip == client_ip.s_addr && memcmp(lease->chaddr, msg->chaddr, 16) == 0;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (!match || __atomic_load_n(&lease->seq, __ATOMIC_RELAXED) != seq)
+        return 0;
+
+    // Fails if the lease manager or a release touched the slot since the read
+    LeaseTimes times = compute_lease_times(pool);
+    if (!__atomic_compare_exchange_n(&lease->lease_expiration, &expiration, time(NULL) + times.lease_time,
+                                     0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        return 0;
+    if (__atomic_load_n(&lease->seq, __ATOMIC_SEQ_CST) != seq)
+        return 0;
+    __atomic_store_n(&lease->renew_time, times.renewal_time, __ATOMIC_RELAXED);
+    count_lease(pool, &times); // Committed, the slow path will not count it again
+    __atomic_fetch_add(&pool->renewals, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&pool->fast_renewals, 1, __ATOMIC_RELAXED);
+    lease_event(LEASE_EVENT_RENEW, client_ip.s_addr, msg->chaddr, lease->relay.s_addr, times.lease_time);
+    trace_point(TRACE_DECIDED, msg->xid, msg->chaddr);
+
+    DHCPMessage ack_msg;
+    build_reply(&ack_msg, cls ? &cls->ack_template : &pool->ack_template, msg, client_ip.s_addr, &times);
+    send_reply(sink, &ack_msg, client_addr);
+    return 1;
+}
+
+void handle_dhcp_renew(ReplySink *sink, DHCPMessage *msg, ClientClass *cls, struct sockaddr_in *client_addr)
 {
     struct in_addr client_ip;
     client_ip.s_addr = msg->ciaddr; // Cambiado de msg->yiaddr a msg->ciaddr
 
-    for (int i = 0; i < lease_count; i++)
+    IPLease *lease = find_lease_slot(client_ip);
+    AddressPool *pool = lease ? find_pool(client_ip) : NULL;
+
+    // The client changed class since it was bound: no ACK, so it goes back
+    // to DISCOVER once the lease runs out and gets an address from its pool
+    if (pool && !class_may_use(cls, pool))
     {
-        if (ip_leases[i].ip.s_addr == client_ip.s_addr && memcmp(ip_leases[i].chaddr, msg->chaddr, 16) == 0)
-        {
-            // Renew the lease
-            ip_leases[i].lease_expiration = time(NULL) + LEASE_TIME;
-
-            // Send DHCPACK
-            DHCPMessage ack_msg;
-            memset(&ack_msg, 0, sizeof(ack_msg));
-            ack_msg.op = 2; // BOOTREPLY
-            ack_msg.htype = msg->htype;
-            ack_msg.hlen = msg->hlen;
-            ack_msg.xid = msg->xid;
-            memcpy(ack_msg.chaddr, msg->chaddr, 16);
-            ack_msg.yiaddr = client_ip.s_addr;
-
-            // Set DHCP options
-            uint8_t *options = ack_msg.options;
-            options[0] = 0x63; // Magic cookie
-            options[1] = 0x82;
-            options[2] = 0x53;
-            options[3] = 0x63;
-
-            options[4] = 53; // DHCP Message Type
-            options[5] = 1;  // Length
-            options[6] = 5;  // DHCPACK
-
-            options[7] = 51; // IP Address Lease Time
-            options[8] = 4;  // Length
-            uint32_t lease_time = htonl(LEASE_TIME);
-            memcpy(&options[9], &lease_time, 4);
-
-            options[13] = 1; // Subnet Mask
-            options[14] = 4; // Length
-            memcpy(&options[15], &subnet_mask, 4);
-
-            options[19] = 6; // DNS Server
-            options[20] = 4; // Length
-            struct in_addr dns_server;
-            inet_aton(DNS_SERVER, &dns_server);
-            memcpy(&options[21], &dns_server, 4);
-
-            options[25] = 3; // Router (Default Gateway)
-            options[26] = 4; // Length
-            memcpy(&options[27], &default_gateway, 4);
-
-            options[31] = 255; // End option
-
-            sendto(sockfd, &ack_msg, sizeof(ack_msg), 0, (struct sockaddr *)client_addr, sizeof(*client_addr));
-            printf("Renewed lease for IP: %s\n", inet_ntoa(client_ip));
-            return;
-        }
+        LOG("Renewal of %s refused, not in the client's class pool\n", inet_ntoa(client_ip));
+        return;
+    }
+
+    if (lease && lease->ip.s_addr == client_ip.s_addr && memcmp(lease->chaddr, msg->chaddr, 16) == 0)
+    {
+        // Renew the lease
+        LeaseTimes times = compute_lease_times(pool);
+        lease_write_begin(lease);
+        __atomic_store_n(&lease->lease_expiration, time(NULL) + times.lease_time, __ATOMIC_SEQ_CST);
+        lease->renew_time = times.renewal_time;
+        lease_write_end(lease);
+        count_lease(pool, &times);
+        __atomic_fetch_add(&pool->renewals, 1, __ATOMIC_RELAXED);
+        lease_event(LEASE_EVENT_RENEW, client_ip.s_addr, msg->chaddr, lease->relay.s_addr, times.lease_time);
+        trace_point(TRACE_DECIDED, msg->xid, msg->chaddr);
+
+        // Send DHCPACK
+        DHCPMessage ack_msg;
+        build_reply(&ack_msg, cls ? &cls->ack_template : &pool->ack_template, msg, client_ip.s_addr, &times);
+
+        send_reply(sink, &ack_msg, client_addr);
+        LOG("Renewed lease for IP: %s\n", inet_ntoa(client_ip));
+        return;
+    }
+
+    // Our address but no binding: the node that held it is gone, adopt it
+    if (cluster_enabled && lease && lease->ip.s_addr == 0 && cluster_may_allocate(lease - ip_leases))
+    {
+        LeaseTimes times = compute_lease_times(pool);
+        bind_lease(lease, client_ip, msg->chaddr, msg->giaddr, times.lease_time, times.renewal_time);
+        count_lease(pool, &times);
+        trace_point(TRACE_DECIDED, msg->xid, msg->chaddr);
+
+        DHCPMessage ack_msg;
+        build_reply(&ack_msg, cls ? &cls->ack_template : &pool->ack_template, msg, client_ip.s_addr, &times);
+        send_reply(sink, &ack_msg, client_addr);
+        LOG("Adopted lease for IP: %s\n", inet_ntoa(client_ip));
+        return;
+    }
+    LOG("Renewal failed for IP: %s\n", inet_ntoa(client_ip));
+}
+
+// Called once per second by the lease manager with the mutex held
+void update_pool_stats()
+{
+    for (int i = 0; i < pool_count; i++)
+    {
+        AddressPool *pool = &pools[i];
+        uint64_t renewals = __atomic_load_n(&pool->renewals, __ATOMIC_RELAXED);
+        double delta = (double)(renewals - pool->renewals_seen);
+        pool->renewals_seen = renewals;
+        pool->renew_rate = pool->renew_rate * 0.9 + delta * 0.1;
+        pool->expected_renew_rate = 0.0;
+    }
+    for (uint32_t i = 0; i < lease_slots; i++)
+    {
+        if (ip_leases[i].ip.s_addr == 0)
+            continue;
+        AddressPool *pool = find_pool(ip_leases[i].ip);
+        uint32_t renew_time = __atomic_load_n(&ip_leases[i].renew_time, __ATOMIC_RELAXED);
+        if (renew_time)
+            pool->expected_renew_rate += 1.0 / renew_time;
+    }
+}
+
+// What the kernel threw away before a worker saw it: filtered or
+// overflowing datagrams on a UDP socket, full rings on a packet socket
+void print_kernel_stats()
+{
+    uint32_t meminfo[SK_MEMINFO_VARS];
+    struct tpacket_stats_v3 packet_stats;
+    socklen_t len = sizeof(meminfo);
+
+    if (stats_sockfd < 0)
+        return;
+    if (getsockopt(stats_sockfd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) == 0)
+        printf("Kernel: %u dropped (filter or full queue), %u bytes queued", meminfo[SK_MEMINFO_DROPS], meminfo[SK_MEMINFO_RMEM_ALLOC]);
+    len = sizeof(packet_stats);
+    if (getsockopt(stats_sockfd, SOL_PACKET, PACKET_STATISTICS, &packet_stats, &len) == 0)
+    {
+        packet_drops += packet_stats.tp_drops;
+        printf(", %lu dropped on a full ring", packet_drops);
+    }
+    printf("\n");
+}
+
+// Printed from the engine's own thread, the only one writing its counters
+void print_engine_stats()
+{
+    uint64_t received, sent, enters, kicks, drops;
+    if (stats_uring)
+    {
+        uring_engine_stats(stats_uring, &received, &sent, &enters);
+        printf("io_uring: %lu received, %lu sent, %lu io_uring_enter calls (%.2f per message)\n",
+               received, sent, enters, received + sent ? (double)enters / (received + sent) : 0.0);
+    }
+    if (stats_packet)
+    {
+        packet_engine_stats(stats_packet, &received, &sent, &kicks, &drops);
+        printf("Packet rings: %lu received, %lu sent, %lu TX kicks, %lu replies dropped on a full TX ring\n",
+               received, sent, kicks, drops);
     }
-    printf("Renewal failed for IP: %s\n", inet_ntoa(client_ip));
 }
 
 void print_active_leases()
 {
+    if (quiet)
+        return;
     pthread_mutex_lock(&mutex);
     printf("\n--- Active IP Leases ---\n");
-    for (int i = 0; i < lease_count; i++)
+    for (uint32_t i = 0; i < lease_slots; i++)
     {
+        if (ip_leases[i].ip.s_addr == 0)
+            continue;
         char mac_str[18];
         snprintf(mac_str, sizeof(mac_str), "%02x:%02x:%02x:%02x:%02x:%02x",
                  ip_leases[i].chaddr[0], ip_leases[i].chaddr[1], ip_leases[i].chaddr[2],
                  ip_leases[i].chaddr[3], ip_leases[i].chaddr[4], ip_leases[i].chaddr[5]);
 
-        time_t remaining = ip_leases[i].lease_expiration - time(NULL);
+        time_t remaining = __atomic_load_n(&ip_leases[i].lease_expiration, __ATOMIC_RELAXED) - time(NULL);
 
         printf("IP: %s, Expires in: %ld seconds\n",
                inet_ntoa(ip_leases[i].ip), remaining);
     }
+    for (int i = 0; i < pool_count; i++)
+    {
+        AddressPool *pool = &pools[i];
+        printf("Pool %s", inet_ntoa(pool->range_start));
+        printf("-%s: %u/%u in use (%u%%), lease %us, avg lease %.0fs, renewals %.3f/s (expected %.3f/s, %lu lock-free)\n",
+               inet_ntoa(pool->range_end), pool->active, pool_size(pool), pool_utilization(pool),
+               pool->last_lease_time,
+               pool->leases_granted ? (double)pool->lease_time_total / pool->leases_granted : 0.0,
+               pool->renew_rate, pool->expected_renew_rate, pool->fast_renewals);
+    }
+    print_kernel_stats();
+    print_engine_stats();
+    events_print_stats();
+    probe_print_stats();
+    cluster_print_stats();
+    classes_print_stats();
+    trace_print_stats();
     printf("------------------------\n\n");
     pthread_mutex_unlock(&mutex);
 }
 
+// Runs one received message through the server. Returns 0 if the message was
+// dropped before reaching a handler (malformed, not a request or, in cluster
+// mode, for another node)
+int process_dhcp_message(ReplySink *sink, DHCPMessage *dhcp_msg, size_t len, struct sockaddr_in *client_addr)
+{
+    DHCPOptions opts;
+    if (!dhcp_index_options(dhcp_msg, len, &opts) || dhcp_msg->op != 1) // BOOTREQUEST
+        return 0;
+    trace_point(TRACE_RECV, dhcp_msg->xid, dhcp_msg->chaddr);
+    if (cluster_enabled && !cluster_accepts(dhcp_msg, &opts))
+        return 0; // Another node's client or address
+
+    ClientClass *cls = classify(dhcp_msg, &opts);
+
+    // Renewals of a known binding never touch the mutex
+    if (opts.message_type == DHCPREQUEST && dhcp_msg->ciaddr != 0 && handle_dhcp_renew_fast(sink, dhcp_msg, cls, client_addr))
+        return 1;
+
+    // Process DHCP message
+    pthread_mutex_lock(&mutex);
+    trace_point(TRACE_LOCKED, dhcp_msg->xid, dhcp_msg->chaddr);
+    switch (opts.message_type)
+    {
+    case DHCPDISCOVER:
+        handle_dhcp_discover(sink, dhcp_msg, cls, client_addr);
+        break;
+    case DHCPRELEASE:
+        handle_dhcp_release(dhcp_msg);
+        break;
+    case DHCPDECLINE:
+        handle_dhcp_decline(dhcp_msg, &opts);
+        break;
+    case DHCPREQUEST: // Could be new request or renewal
+        if (dhcp_msg->ciaddr != 0)
+        {
+            handle_dhcp_renew(sink, dhcp_msg, cls, client_addr);
+        }
+        else
+        {
+            handle_dhcp_request(sink, dhcp_msg, &opts, cls, client_addr);
+        }
+        break;
+    default:
+        LOG("Unknown DHCP message type\n");
+        break;
+    }
+    pthread_mutex_unlock(&mutex);
+    print_active_leases();
+    return 1;
+}
+
+// What the kernel filter lets through: the message types handled above
+void server_filter_config(DHCPFilterConfig *config)
+{
+    config->htype = HARDWARE_TYPE;
+    config->hlen = HARDWARE_LEN;
+    config->message_types = 1u << DHCPDISCOVER | 1u << DHCPREQUEST | 1u << DHCPDECLINE | 1u << DHCPRELEASE;
+}
+
 void *handle_client(void *arg)
 {
-    int sockfd = *(int *)arg;
+    ReplySink sink = {*(int *)arg, NULL, NULL};
     struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
+    socklen_t client_len;
     char buffer[BUFFER_SIZE];
-    DHCPMessage *dhcp_msg;
 
+    print_active_leases();
     while (1)
     {
         // Receive DHCP message
-        print_active_leases();
-        ssize_t recv_len = recvfrom(sockfd, buffer, BUFFER_SIZE, 0, (struct sockaddr *)&client_addr, &client_len);
+        client_len = sizeof(client_addr);
+        ssize_t recv_len = recvfrom(sink.sockfd, buffer, BUFFER_SIZE, 0, (struct sockaddr *)&client_addr, &client_len);
         if (recv_len < 0)
         {
             perror("Error receiving data");
             continue;
         }
 
-        dhcp_msg = (DHCPMessage *)buffer;
+        process_dhcp_message(&sink, (DHCPMessage *)buffer, recv_len, &client_addr);
+    }
 
-        // Process DHCP message
-        pthread_mutex_lock(&mutex);
-        switch (dhcp_msg->options[6])
+    return NULL;
+}
+
+// Drops every binding that expired before current_time, called with the
+// mutex held. Returns the number of leases removed
+int expire_leases(time_t current_time)
+{
+    int expired = 0;
+    for (uint32_t i = 0; i < lease_slots; i++)
+    {
+        IPLease *lease = &ip_leases[i];
+        if (lease->ip.s_addr == 0 || current_time <= __atomic_load_n(&lease->lease_expiration, __ATOMIC_SEQ_CST))
+            continue;
+
+        // Recheck once the slot is marked busy: a lock-free renewal may
+        // have extended it, otherwise it sees the seq change and retries
+        lease_write_begin(lease);
+        if (current_time <= __atomic_load_n(&lease->lease_expiration, __ATOMIC_SEQ_CST))
         {
-        case 1: // DHCP DISCOVER
-            handle_dhcp_discover(sockfd, dhcp_msg, &client_addr);
-            break;
-        case 7: // DHCP RELEASE
-            handle_dhcp_release(dhcp_msg);
-            break;
-        case 3: // DHCP REQUEST (could be new request or renewal)
-            if (dhcp_msg->ciaddr != 0)
-            {
-                handle_dhcp_renew(sockfd, dhcp_msg, &client_addr);
-            }
-            else
-            {
-                handle_dhcp_request(sockfd, dhcp_msg, &client_addr);
-            }
-            break;
-        default:
-            printf("Unknown DHCP message type\n");
-            break;
+            lease_write_end(lease);
+            continue;
         }
-        pthread_mutex_unlock(&mutex);
+        LOG("Lease expired for IP: %s\n", inet_ntoa(lease->ip));
+        lease_event(LEASE_EVENT_EXPIRE, lease->ip.s_addr, lease->chaddr, lease->relay.s_addr, 0);
+        clear_lease(lease);
+        lease_write_end(lease);
+        expired++;
     }
-
-    return NULL;
+    return expired;
 }
 
 void *lease_manager(void *arg)
@@ -424,34 +823,178 @@ void *lease_manager(void *arg)
     while (1)
     {
         pthread_mutex_lock(&mutex);
-        time_t current_time = time(NULL);
+        expire_leases(time(NULL));
+        update_pool_stats();
+        pthread_mutex_unlock(&mutex);
+        sleep(1); // Check every second
+    }
+    return NULL;
+}
 
-        for (int i = 0; i < lease_count; i++)
+typedef struct
+{
+    ReplayTrace *trace;
+    ReplayStats *stats;
+    size_t index; // Request being processed
+    int replied;
+} ReplayContext;
+
+void replay_deliver(void *arg, DHCPMessage *reply, struct sockaddr_in *dest)
+{
+    ReplayContext *ctx = arg;
+    ctx->replied = 1;
+    capture_check_reply(ctx->trace, ctx->stats, ctx->index, reply, sizeof(*reply));
+}
+
+// Test mode: feeds the DHCP requests of a pcap capture straight into
+// process_dhcp_message, either as fast as possible or at the recorded pace
+int replay_capture(const char *path, int realtime)
+{
+    ReplayTrace trace;
+    if (capture_load(path, &trace) < 0)
+        return 1;
+
+    ReplayStats stats;
+    memset(&stats, 0, sizeof(stats));
+    ReplayContext ctx = {&trace, &stats, 0, 0};
+    ReplySink sink = {-1, replay_deliver, &ctx};
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < trace.request_count; i++)
+    {
+        CapturedRequest *request = &trace.requests[i];
+        if (realtime)
         {
-            if (current_time > ip_leases[i].lease_expiration)
-            {
-                printf("Lease expired for IP: %s\n", inet_ntoa(ip_leases[i].ip));
-
-                // Remove the expired lease
-                for (int j = i; j < lease_count - 1; j++)
-                {
-                    ip_leases[j] = ip_leases[j + 1];
-                }
-                lease_count--;
-                i--; // Adjust index after removal
-            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            double wait = request->timestamp - ((now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9);
+            if (wait > 0)
+                usleep(wait * 1e6);
         }
 
-        pthread_mutex_unlock(&mutex);
-        sleep(1); // Check every second
+        // Handlers get a private copy, like a freshly received datagram
+        DHCPMessage msg = request->msg;
+        struct sockaddr_in client_addr = request->source;
+        ctx.index = i;
+        ctx.replied = 0;
+        process_dhcp_message(&sink, &msg, request->length, &client_addr);
+        stats.messages++;
+        if (!ctx.replied)
+            capture_check_no_reply(&trace, &stats, i);
     }
-    return NULL;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    stats.elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+
+    capture_print_report(&stats);
+    quiet = 0;
+    print_active_leases();
+    capture_free(&trace);
+    return stats.mismatched || stats.missing || stats.unexpected ? 2 : 0;
 }
 
-int main()
+#ifndef SERVER_NO_MAIN
+int main(int argc, char *argv[])
 {
     int sockfd;
     struct sockaddr_in server_addr;
+    const char *replay_path = NULL;
+    int realtime = 0;
+    int use_uring = 0;
+    const char *packet_ifname = NULL;
+    int leasequery_port = -1;
+    const char *events_path = NULL;
+    int probe_method = -1;
+    const char *probe_ifname = NULL;
+    struct sockaddr_in cluster_addr = {0};
+    struct sockaddr_in cluster_peers[32];
+    int cluster_peer_count = 0;
+    const char *trace_path = NULL;
+    uint32_t trace_sample = 1;
+    const char *classes_path = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-q") == 0)
+            quiet = 1;
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            replay_path = argv[++i];
+        else if (strcmp(argv[i], "--realtime") == 0)
+            realtime = 1;
+        else if (strcmp(argv[i], "--io") == 0 && i + 1 < argc && strcmp(argv[i + 1], "threads") == 0)
+            use_uring = 0, i++;
+        else if (strcmp(argv[i], "--io") == 0 && i + 1 < argc && strcmp(argv[i + 1], "uring") == 0)
+            use_uring = 1, i++;
+        else if (strcmp(argv[i], "--io") == 0 && i + 2 < argc && strcmp(argv[i + 1], "packet") == 0)
+            packet_ifname = argv[i + 2], i += 2;
+        else if (strcmp(argv[i], "--leasequery") == 0 && i + 1 < argc)
+            leasequery_port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--events") == 0 && i + 1 < argc)
+            events_path = argv[++i];
+        else if (strcmp(argv[i], "--probe") == 0 && i + 1 < argc && strcmp(argv[i + 1], "icmp") == 0)
+            probe_method = PROBE_ICMP, i++;
+        else if (strcmp(argv[i], "--probe") == 0 && i + 2 < argc && strcmp(argv[i + 1], "arp") == 0)
+            probe_method = PROBE_ARP, probe_ifname = argv[i + 2], i += 2;
+        else if (strcmp(argv[i], "--cluster") == 0 && i + 1 < argc && cluster_parse_address(argv[i + 1], &cluster_addr) == 0)
+            i++;
+        else if (strcmp(argv[i], "--peer") == 0 && i + 1 < argc && cluster_peer_count < 32 &&
+                 cluster_parse_address(argv[i + 1], &cluster_peers[cluster_peer_count]) == 0)
+            cluster_peer_count++, i++;
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            trace_path = argv[++i];
+        else if (strcmp(argv[i], "--trace-sample") == 0 && i + 1 < argc)
+            trace_sample = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--classes") == 0 && i + 1 < argc)
+            classes_path = argv[++i];
+        else
+        {
+            fprintf(stderr, "Usage: %s [-q] [--io threads|uring|packet IFACE] [--leasequery PORT] [--events SOCKET] [--probe icmp|arp IFACE] [--cluster IP:PORT [--peer IP:PORT]...] [--trace FILE [--trace-sample N]] [--classes FILE] [--replay capture.pcap [--realtime]]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    if (trace_path && trace_start(trace_path, "server", trace_sample) < 0)
+        exit(1);
+
+    if (replay_path)
+    {
+        initialize_network();
+        add_pool(ip_range_start, ip_range_end);
+        if (classes_path && classes_load(classes_path) < 0)
+            exit(1);
+
+        // Leases can only expire when replaying at the recorded pace
+        pthread_t lease_manager_tid;
+        if (realtime && pthread_create(&lease_manager_tid, NULL, lease_manager, NULL) != 0)
+        {
+            perror("Failed to create lease manager thread");
+            exit(1);
+        }
+        return replay_capture(replay_path, realtime);
+    }
+
+    // The packet engine takes its requests off the wire, no UDP socket
+    if (packet_ifname)
+    {
+        initialize_network();
+        add_pool(ip_range_start, ip_range_end);
+        if (classes_path && classes_load(classes_path) < 0)
+            exit(1);
+        if (leasequery_port >= 0 && leasequery_start(leasequery_port) < 0)
+            exit(1);
+        if (events_path && events_start(events_path) < 0)
+            exit(1);
+        if (probe_method >= 0 && probe_start(probe_method, probe_ifname) < 0)
+            exit(1);
+        if (cluster_addr.sin_port && cluster_start(&cluster_addr, cluster_peers, cluster_peer_count) < 0)
+            exit(1);
+        PacketEngine *engine = packet_engine_create(packet_ifname);
+        if (!engine)
+            exit(1);
+        stats_packet = engine;
+        printf("DHCP server is running (packet rings on %s)...\n", packet_ifname);
+        packet_engine_run(engine);
+        exit(1);
+    }
 
     // Create UDP socket
     sockfd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -467,6 +1010,13 @@ int main()
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port = htons(DHCP_SERVER_PORT);
 
+    // Cluster nodes on one host share the port, broadcasts reach all of them
+    if (cluster_addr.sin_port)
+    {
+        int enable = 1;
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    }
+
     // Bind socket to address
     if (bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
     {
@@ -476,10 +1026,42 @@ int main()
     }
 
     initialize_network();
+    add_pool(ip_range_start, ip_range_end); // Default pool covering the configured range
+    if (classes_path && classes_load(classes_path) < 0)
+        exit(1);
+
+    // Drop in the kernel what the workers would throw away
+    DHCPFilterConfig filter;
+    server_filter_config(&filter);
+    dhcp_filter_attach(sockfd, &filter, FILTER_UDP);
+    stats_sockfd = sockfd;
+
+    if (leasequery_port >= 0 && leasequery_start(leasequery_port) < 0)
+        exit(1);
+    if (events_path && events_start(events_path) < 0)
+        exit(1);
+    if (probe_method >= 0 && probe_start(probe_method, probe_ifname) < 0)
+        exit(1);
+    if (cluster_addr.sin_port && cluster_start(&cluster_addr, cluster_peers, cluster_peer_count) < 0)
+        exit(1);
+
+    // The io_uring engine runs the expiry tick on its own ring
+    if (use_uring)
+    {
+        UringEngine *engine = uring_engine_create(sockfd);
+        if (engine)
+        {
+            stats_uring = engine;
+            printf("DHCP server is running (io_uring)...\n");
+            uring_engine_run(engine);
+            exit(1);
+        }
+        fprintf(stderr, "io_uring unavailable, falling back to worker threads\n");
+    }
 
     printf("DHCP server is running...\n");
 
-    pthread_t lease_manager_tid, lease_display_tid;
+    pthread_t lease_manager_tid;
     if (pthread_create(&lease_manager_tid, NULL, lease_manager, NULL) != 0)
     {
         perror("Failed to create lease manager thread");
@@ -503,3 +1085,4 @@ int main()
     close(sockfd);
     return 0;
 }
+#endif
@@ -0,0 +1,173 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include "dhcp.h"
+#include "filter.h"
+#include "events.h"
+#include "trace.h"
+
+// Server internals shared with the tools that drive the message pipeline
+// in-process (benchmarks). The server itself is built from server.c; define
+// SERVER_NO_MAIN to link it into another program.
+
+#define MAX_POOLS 8
+#define MAX_LEASES 65536
+#define DHCP_SERVER_PORT 67
+
+// Lease slots never move: each pool owns a contiguous run of slots indexed by
+// address offset. Writers hold the mutex and bump seq around every change
+// (odd while in progress) so the renewal fast path can read without it.
+typedef struct
+{
+    uint32_t seq;
+    struct in_addr ip; // 0 when the slot is free
+    time_t lease_start;
+    time_t lease_expiration;
+    uint32_t renew_time; // T1 handed to the client
+    uint8_t chaddr[16];
+    struct in_addr relay; // giaddr the binding came through, 0 if direct
+} IPLease;
+
+typedef struct
+{
+    uint32_t min_lease;
+    uint32_t max_lease;
+    uint8_t util_low;
+    uint8_t util_high;
+    uint8_t jitter;
+} LeasePolicy;
+
+typedef struct
+{
+    struct in_addr range_start;
+    struct in_addr range_end;
+    LeasePolicy policy;
+    uint32_t slot_base; // First slot in ip_leases[]
+    uint32_t active;    // Bindings currently held from this pool
+    int reserved;       // Declared by a client class, only its clients draw from it
+    DHCPMessage offer_template;
+    DHCPMessage ack_template;
+
+    // Statistics
+    uint64_t leases_granted;
+    uint64_t lease_time_total;
+    uint32_t last_lease_time;
+    uint64_t renewals;
+    uint64_t fast_renewals; // Renewals served without taking the mutex
+    uint64_t renewals_seen;     // Renewals already folded into renew_rate
+    double renew_rate;          // Observed renewals per second (EWMA)
+    double expected_renew_rate; // Sum of 1/T1 over active bindings
+} AddressPool;
+
+typedef struct
+{
+    uint32_t lease_time;
+    uint32_t renewal_time;  // T1, option 58
+    uint32_t rebinding_time; // T2, option 59
+} LeaseTimes;
+
+extern IPLease ip_leases[MAX_LEASES];
+extern int lease_count;
+extern uint32_t lease_slots;
+extern AddressPool pools[MAX_POOLS];
+extern int pool_count;
+extern struct in_addr subnet_mask;
+extern struct in_addr default_gateway;
+extern pthread_mutex_t mutex;
+
+// Set by -q to silence the per-packet log lines
+extern int quiet;
+// Socket whose kernel drop counters are reported with the lease table
+extern int stats_sockfd;
+#define LOG(...)                 \
+    do                           \
+    {                            \
+        if (!quiet)              \
+            printf(__VA_ARGS__); \
+    } while (0)
+
+// Where replies go: the server socket, or a callback when messages are fed
+// in-process (replay, tests) without any socket at all
+typedef struct
+{
+    int sockfd;
+    void (*deliver)(void *arg, DHCPMessage *reply, struct sockaddr_in *dest);
+    void *arg;
+} ReplySink;
+
+void initialize_network();
+AddressPool *add_pool(struct in_addr range_start, struct in_addr range_end);
+AddressPool *find_pool(struct in_addr ip);
+uint32_t pool_size(AddressPool *pool);
+IPLease *find_lease_slot(struct in_addr ip);
+int lease_read(IPLease *lease, IPLease *copy);
+void bind_lease(IPLease *lease, struct in_addr ip, uint8_t *chaddr, uint32_t relay, uint32_t lease_time, uint32_t renew_time);
+void unbind_lease(IPLease *lease);
+struct in_addr get_available_ip(AddressPool *pool); // NULL for the pools no class reserved
+LeaseTimes compute_lease_times(AddressPool *pool);
+void count_lease(AddressPool *pool, LeaseTimes *times);
+void set_reply_options(uint8_t *options, uint8_t message_type, LeaseTimes *times);
+void build_reply(DHCPMessage *reply, DHCPMessage *template, DHCPMessage *msg, uint32_t yiaddr, LeaseTimes *times);
+int process_dhcp_message(ReplySink *sink, DHCPMessage *dhcp_msg, size_t len, struct sockaddr_in *client_addr);
+int expire_leases(time_t current_time);
+void update_pool_stats();
+void print_active_leases();
+void server_filter_config(DHCPFilterConfig *config);
+
+// I/O engines, picked with --io at startup
+void *handle_client(void *arg); // Blocking recvfrom/sendto worker thread
+
+typedef struct UringEngine UringEngine;
+UringEngine *uring_engine_create(int sockfd); // NULL if io_uring is unavailable
+void uring_engine_run(UringEngine *engine);  // Never returns unless the ring fails
+void uring_engine_stats(UringEngine *engine, uint64_t *received, uint64_t *sent, uint64_t *enters);
+
+typedef struct PacketEngine PacketEngine;
+PacketEngine *packet_engine_create(const char *ifname); // NULL without CAP_NET_RAW or TPACKET_V3
+void packet_engine_run(PacketEngine *engine);            // Never returns unless poll fails
+void packet_engine_stats(PacketEngine *engine, uint64_t *received, uint64_t *sent, uint64_t *kicks, uint64_t *drops);
+
+// Bulk leasequery (RFC 6926) listener on TCP port, 0 for any; returns the
+// port bound or -1. Connections are served on their own threads.
+int leasequery_start(uint16_t port);
+
+// Address conflict probing before OFFER, see probe.c
+#define PROBE_ICMP 0
+#define PROBE_ARP 1 // On the interface given, for clients on the server's link
+extern int probing_enabled;
+int probe_start(int method, const char *ifname); // -1 without raw socket access
+struct in_addr probe_take(AddressPool *pool);    // Verified free address, INADDR_NONE if none is ready
+void probe_quarantine(struct in_addr ip);
+int probe_quarantined(uint32_t slot);
+void probe_print_stats();
+
+// Horizontal partitioning across server processes, see cluster.c
+extern int cluster_enabled;
+int cluster_parse_address(const char *text, struct sockaddr_in *address); // IP:PORT
+int cluster_start(struct sockaddr_in *self, struct sockaddr_in *peers, int peer_count);
+int cluster_accepts(DHCPMessage *msg, DHCPOptions *opts); // 0 if another node answers it
+int cluster_may_allocate(uint32_t slot);
+int cluster_owns(uint32_t slot);
+void cluster_print_stats();
+
+// Client classes from --classes, see classify.c
+typedef struct
+{
+    char name[32];
+    AddressPool *pool; // Own addresses, NULL for the shared pools
+    DHCPMessage offer_template;
+    DHCPMessage ack_template;
+    uint64_t matched;
+} ClientClass;
+
+extern int class_count;
+int classes_load(const char *path); // After the default pool; -1 on a bad file
+ClientClass *classify(DHCPMessage *msg, DHCPOptions *opts); // NULL for the default options
+void classes_print_stats();
+
+#endif
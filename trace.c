@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+#define TRACE_RING 16384  // Records per thread, power of two
+#define TRACE_FLUSH_MS 50 // Flusher wakeup, how long records wait in a ring
+
+// One per thread that has traced something. Only the owner moves head and
+// only the flusher moves tail, so neither side needs more than the ordering
+// on those two counters
+typedef struct TraceRing
+{
+    TraceRecord records[TRACE_RING];
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t tail __attribute__((aligned(64)));
+    uint32_t tid;
+    uint64_t drops;
+    struct TraceRing *next;
+} TraceRing;
+
+int trace_enabled = 0;
+uint32_t trace_sample = 1;
+
+TraceRing *trace_rings = NULL; // Rings are never freed, threads come and go rarely
+__thread TraceRing *local_ring = NULL;
+FILE *trace_file = NULL;
+pthread_t flusher_tid;
+volatile int flusher_stop = 0;
+uint64_t records_written = 0;
+
+const char *stage_names[TRACE_STAGES] = {
+    "?", "client send", "recv", "lock acquired", "lease decided",
+    "reply encoded", "sent", "relay recv", "relayed", "client recv",
+};
+
+const char *trace_stage_name(uint8_t stage)
+{
+    return stage < TRACE_STAGES ? stage_names[stage] : stage_names[0];
+}
+
+uint64_t trace_clock(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Same answer in every process for the same xid
+int trace_sampled(uint32_t xid)
+{
+    if (trace_sample <= 1)
+        return 1;
+    xid ^= xid >> 16;
+    xid *= 0x85ebca6b;
+    xid ^= xid >> 13;
+    xid *= 0xc2b2ae35;
+    xid ^= xid >> 16;
+    return xid % trace_sample == 0;
+}
+
+TraceRing *trace_register()
+{
+    TraceRing *ring = calloc(1, sizeof(TraceRing));
+    ring->tid = syscall(SYS_gettid);
+    ring->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&trace_rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    local_ring = ring;
+    return ring;
+}
+
+void trace_point(uint8_t stage, uint32_t xid, const uint8_t *chaddr)
+{
+    if (!trace_enabled || !trace_sampled(xid))
+        return;
+    TraceRing *ring = local_ring ? local_ring : trace_register();
+
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING)
+    {
+        ring->drops++;
+        return;
+    }
+    TraceRecord *record = &ring->records[head % TRACE_RING];
+    record->time_ns = trace_clock(CLOCK_MONOTONIC);
+    record->xid = xid;
+    record->tid = ring->tid;
+    record->stage = stage;
+    memcpy(record->chaddr, chaddr, 16);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Appends every ring's pending records to the file, at most two writes each
+void trace_drain()
+{
+    for (TraceRing *ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        uint32_t tail = ring->tail;
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        while (tail != head)
+        {
+            uint32_t start = tail % TRACE_RING;
+            uint32_t count = head - tail;
+            if (start + count > TRACE_RING)
+                count = TRACE_RING - start; // Up to the end of the ring first
+            fwrite(&ring->records[start], sizeof(TraceRecord), count, trace_file);
+            tail += count;
+            records_written += count;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    fflush(trace_file);
+}
+
+void *trace_flusher(void *arg)
+{
+    struct timespec delay = {0, TRACE_FLUSH_MS * 1000000};
+    while (!flusher_stop)
+    {
+        nanosleep(&delay, NULL);
+        trace_drain();
+    }
+    trace_drain();
+    return NULL;
+}
+
+int trace_start(const char *path, const char *component, uint32_t sample)
+{
+    trace_file = fopen(path, "wb");
+    if (!trace_file)
+    {
+        perror("Error creating trace file");
+        return -1;
+    }
+
+    TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, 4);
+    header.pid = getpid();
+    snprintf(header.component, sizeof(header.component), "%s", component);
+    header.monotonic_ns = trace_clock(CLOCK_MONOTONIC);
+    header.realtime_ns = trace_clock(CLOCK_REALTIME);
+    fwrite(&header, sizeof(header), 1, trace_file);
+
+    trace_sample = sample ? sample : 1;
+    if (pthread_create(&flusher_tid, NULL, trace_flusher, NULL) != 0)
+    {
+        perror("Failed to create trace flusher thread");
+        fclose(trace_file);
+        return -1;
+    }
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+    atexit(trace_stop); // A normal exit keeps the last records
+    return 0;
+}
+
+void trace_stop()
+{
+    if (!trace_enabled)
+        return;
+    trace_enabled = 0;
+    flusher_stop = 1;
+    pthread_join(flusher_tid, NULL);
+    fclose(trace_file);
+}
+
+void trace_print_stats()
+{
+    if (!trace_enabled)
+        return;
+    uint64_t drops = 0;
+    for (TraceRing *ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+        drops += ring->drops;
+    printf("Trace: 1 in %u transactions, %lu records written, %lu dropped on a full ring\n", trace_sample, records_written, drops);
+}
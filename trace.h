@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Per-transaction tracing shared by the server, the relay and the client.
+// Each component timestamps a transaction (xid + chaddr) as it crosses stage
+// boundaries. Records go into a ring owned by the calling thread, so the
+// packet path never takes a lock, and a flusher thread appends them to a
+// binary file. tracemerge.out lines up the files of every component into
+// per-transaction waterfalls and Chrome trace-event JSON.
+//
+// Sampling is decided from the xid alone, so every component traces the
+// same transactions without talking to each other.
+
+#define TRACE_CLIENT_SEND 1
+#define TRACE_RECV 2    // Server received the request
+#define TRACE_LOCKED 3  // Server holds the mutex
+#define TRACE_DECIDED 4 // Lease bound, renewed or picked for an offer
+#define TRACE_ENCODED 5 // Reply built, about to be handed to the socket or engine
+#define TRACE_SENT 6    // Reply sent, or queued on the uring and packet engines
+#define TRACE_RELAY_RECV 7
+#define TRACE_RELAYED 8
+#define TRACE_CLIENT_RECV 9
+#define TRACE_STAGES 10
+
+#define TRACE_MAGIC "DTR1"
+
+// File header, then TraceRecords until the end of the file
+typedef struct
+{
+    char magic[4];
+    uint32_t pid;
+    char component[16];
+    uint64_t monotonic_ns; // Both clocks read together, to line up files
+    uint64_t realtime_ns;  // written by processes on different hosts
+} TraceHeader;
+
+typedef struct
+{
+    uint64_t time_ns; // CLOCK_MONOTONIC
+    uint32_t xid;     // As on the wire
+    uint32_t tid;
+    uint8_t stage;
+    uint8_t reserved[7];
+    uint8_t chaddr[16];
+} TraceRecord;
+
+extern int trace_enabled;
+
+// Starts writing to path; 1 in every sample transactions is traced.
+// Returns -1 if the file can't be created
+int trace_start(const char *path, const char *component, uint32_t sample);
+
+// Records a stage of transaction xid. Lock-free; drops the record if the
+// thread's ring is full
+void trace_point(uint8_t stage, uint32_t xid, const uint8_t *chaddr);
+
+// Writes out what is still buffered and closes the file
+void trace_stop();
+
+void trace_print_stats();
+
+const char *trace_stage_name(uint8_t stage);
+
+#endif
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include "trace.h"
+
+// Merges the files written with --trace by the client, relay and server into
+// per-transaction waterfalls. Records with the same xid and chaddr less than
+// TRANSACTION_GAP_NS apart belong to one transaction, so a client reusing its
+// xid for a later renewal starts a new one.
+//
+// CLOCK_MONOTONIC is shared by the processes of a host, so files whose
+// wall-clock offsets agree within SAME_HOST_NS stay on it; the others are
+// lined up by their wall clock, only as good as the hosts' time sync.
+
+#define MAX_FILES 64
+#define TRANSACTION_GAP_NS 2000000000ll
+#define SAME_HOST_NS 10000000ll
+
+typedef struct
+{
+    TraceRecord record;
+    int64_t time_ns; // On the first file's monotonic clock
+    int file;
+} Point;
+
+typedef struct
+{
+    uint64_t *values;
+    size_t count;
+    size_t capacity;
+} Samples;
+
+TraceHeader headers[MAX_FILES];
+int file_count = 0;
+Point *points = NULL;
+size_t point_count = 0;
+Samples stage_gaps[TRACE_STAGES][TRACE_STAGES]; // Between consecutive stages of a transaction
+Samples totals;
+
+void add_sample(Samples *samples, uint64_t value)
+{
+    if (samples->count == samples->capacity)
+    {
+        samples->capacity = samples->capacity ? samples->capacity * 2 : 64;
+        samples->values = realloc(samples->values, samples->capacity * sizeof(uint64_t));
+    }
+    samples->values[samples->count++] = value;
+}
+
+int compare_u64(const void *a, const void *b)
+{
+    uint64_t va = *(const uint64_t *)a, vb = *(const uint64_t *)b;
+    return va < vb ? -1 : va > vb;
+}
+
+int compare_points(const void *a, const void *b)
+{
+    const Point *pa = a, *pb = b;
+    if (pa->record.xid != pb->record.xid)
+        return pa->record.xid < pb->record.xid ? -1 : 1;
+    int c = memcmp(pa->record.chaddr, pb->record.chaddr, 16);
+    if (c)
+        return c;
+    return pa->time_ns < pb->time_ns ? -1 : pa->time_ns > pb->time_ns;
+}
+
+int load(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        perror(path);
+        return -1;
+    }
+    TraceHeader *header = &headers[file_count];
+    if (fread(header, sizeof(*header), 1, file) != 1 || memcmp(header->magic, TRACE_MAGIC, 4) != 0)
+    {
+        fprintf(stderr, "%s: not a trace file\n", path);
+        fclose(file);
+        return -1;
+    }
+    header->component[sizeof(header->component) - 1] = '\0';
+
+    int64_t offset = (int64_t)(header->realtime_ns - header->monotonic_ns) - (int64_t)(headers[0].realtime_ns - headers[0].monotonic_ns);
+    if (offset > -SAME_HOST_NS && offset < SAME_HOST_NS)
+        offset = 0;
+
+    size_t capacity = point_count;
+    TraceRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        if (point_count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 4096;
+            points = realloc(points, capacity * sizeof(Point));
+        }
+        points[point_count].record = record;
+        points[point_count].time_ns = (int64_t)record.time_ns + offset;
+        points[point_count].file = file_count;
+        point_count++;
+    }
+    fclose(file);
+    file_count++;
+    return 0;
+}
+
+void format_mac(const uint8_t *chaddr, char *out)
+{
+    snprintf(out, 18, "%02x:%02x:%02x:%02x:%02x:%02x", chaddr[0], chaddr[1], chaddr[2], chaddr[3], chaddr[4], chaddr[5]);
+}
+
+void print_waterfall(Point *first, size_t count)
+{
+    char mac[18];
+    format_mac(first->record.chaddr, mac);
+    printf("xid 0x%08x %s %.3f ms\n", ntohl(first->record.xid), mac, (first[count - 1].time_ns - first->time_ns) / 1e6);
+    for (size_t i = 0; i < count; i++)
+        printf("  %10.3f ms  %-8s %s\n", (first[i].time_ns - first->time_ns) / 1e6,
+               headers[first[i].file].component, trace_stage_name(first[i].record.stage));
+}
+
+// Spans between consecutive stages seen by the same thread, plus the whole
+// transaction as an async track with a mark at every stage
+void write_chrome(FILE *out, Point *first, size_t count, size_t id, int64_t base, int *comma)
+{
+    char mac[18];
+    format_mac(first->record.chaddr, mac);
+    uint32_t xid = ntohl(first->record.xid);
+
+    fprintf(out, "%s\n{\"name\":\"xid 0x%08x %s\",\"cat\":\"transaction\",\"ph\":\"b\",\"id\":%zu,\"pid\":%u,\"tid\":%u,\"ts\":%.3f}",
+            *comma ? "," : "", xid, mac, id, headers[first->file].pid, first->record.tid, (first->time_ns - base) / 1e3);
+    *comma = 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        Point *point = &first[i];
+        fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"transaction\",\"ph\":\"n\",\"id\":%zu,\"pid\":%u,\"tid\":%u,\"ts\":%.3f}",
+                trace_stage_name(point->record.stage), id, headers[first->file].pid, first->record.tid, (point->time_ns - base) / 1e3);
+        for (size_t j = i + 1; j < count; j++)
+        {
+            if (first[j].file != point->file || first[j].record.tid != point->record.tid)
+                continue;
+            fprintf(out, ",\n{\"name\":\"%s -> %s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"xid\":\"0x%08x\",\"chaddr\":\"%s\"}}",
+                    trace_stage_name(point->record.stage), trace_stage_name(first[j].record.stage),
+                    headers[point->file].pid, point->record.tid, (point->time_ns - base) / 1e3,
+                    (first[j].time_ns - point->time_ns) / 1e3, xid, mac);
+            break;
+        }
+    }
+    fprintf(out, ",\n{\"name\":\"xid 0x%08x %s\",\"cat\":\"transaction\",\"ph\":\"e\",\"id\":%zu,\"pid\":%u,\"tid\":%u,\"ts\":%.3f}",
+            xid, mac, id, headers[first->file].pid, first->record.tid, (first[count - 1].time_ns - base) / 1e3);
+}
+
+void print_samples(const char *name, Samples *samples)
+{
+    if (samples->count == 0)
+        return;
+    qsort(samples->values, samples->count, sizeof(uint64_t), compare_u64);
+    double sum = 0;
+    for (size_t i = 0; i < samples->count; i++)
+        sum += samples->values[i];
+    printf("%-34s %8zu %10.1f %10.1f %10.1f %10.1f\n", name, samples->count, sum / samples->count / 1e3,
+           samples->values[samples->count / 2] / 1e3, samples->values[samples->count * 99 / 100] / 1e3,
+           samples->values[samples->count - 1] / 1e3);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *json_path = NULL;
+    int verbose = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+        else if (strcmp(argv[i], "-v") == 0)
+            verbose = 1;
+        else if (argv[i][0] != '-' && file_count < MAX_FILES)
+        {
+            if (load(argv[i]) < 0)
+                exit(1);
+        }
+        else
+            file_count = 0, i = argc;
+    }
+    if (file_count == 0)
+    {
+        fprintf(stderr, "Usage: %s [-v] [-o trace.json] trace_file...\n", argv[0]);
+        exit(1);
+    }
+
+    qsort(points, point_count, sizeof(Point), compare_points);
+    int64_t base = INT64_MAX;
+    for (size_t i = 0; i < point_count; i++)
+        base = points[i].time_ns < base ? points[i].time_ns : base;
+
+    FILE *json = NULL;
+    int comma = 0;
+    if (json_path)
+    {
+        json = fopen(json_path, "w");
+        if (!json)
+        {
+            perror(json_path);
+            exit(1);
+        }
+        fprintf(json, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+        for (int f = 0; f < file_count; f++)
+        {
+            fprintf(json, "%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"%s %u\"}}",
+                    comma ? "," : "", headers[f].pid, headers[f].component, headers[f].pid);
+            comma = 1;
+        }
+    }
+
+    size_t transactions = 0;
+    for (size_t start = 0, end; start < point_count; start = end)
+    {
+        Point *first = &points[start];
+        for (end = start + 1; end < point_count; end++)
+        {
+            if (points[end].record.xid != first->record.xid || memcmp(points[end].record.chaddr, first->record.chaddr, 16) != 0 ||
+                points[end].time_ns - points[end - 1].time_ns > TRANSACTION_GAP_NS)
+                break;
+        }
+        size_t count = end - start;
+        for (size_t i = 1; i < count; i++)
+            add_sample(&stage_gaps[first[i - 1].record.stage % TRACE_STAGES][first[i].record.stage % TRACE_STAGES],
+                       first[i].time_ns - first[i - 1].time_ns);
+        add_sample(&totals, first[count - 1].time_ns - first->time_ns);
+
+        if (verbose)
+            print_waterfall(first, count);
+        if (json)
+            write_chrome(json, first, count, transactions, base, &comma);
+        transactions++;
+    }
+
+    printf("%zu transactions, %zu records from %d files\n", transactions, point_count, file_count);
+    printf("%-34s %8s %10s %10s %10s %10s\n", "Stage", "count", "avg us", "p50 us", "p99 us", "max us");
+    for (int a = 0; a < TRACE_STAGES; a++)
+    {
+        for (int b = 0; b < TRACE_STAGES; b++)
+        {
+            char name[64];
+            snprintf(name, sizeof(name), "%s -> %s", trace_stage_name(a), trace_stage_name(b));
+            print_samples(name, &stage_gaps[a][b]);
+        }
+    }
+    print_samples("whole transaction", &totals);
+
+    if (json)
+    {
+        fprintf(json, "\n]}\n");
+        fclose(json);
+        printf("Chrome trace written to %s\n", json_path);
+    }
+    return 0;
+}
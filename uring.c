@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "server.h"
+
+// io_uring I/O engine: a single multishot recvmsg fed from a provided buffer
+// ring replaces the recvfrom loop, replies go out as sendmsg SQEs submitted in
+// batches with the next io_uring_enter, and the lease expiry tick is a
+// timeout SQE on the same ring, so one syscall per batch does all the work.
+
+#define URING_ENTRIES 256
+#define URING_CQ_ENTRIES 4096
+#define RECV_BUFFERS 256 // Power of two
+#define RECV_BUFFER_SIZE 2048
+#define SEND_SLOTS 256
+#define BUFFER_GROUP 0
+
+// What a completion belongs to, kept in the top byte of user_data
+#define OP_RECV 1ull
+#define OP_SEND 2ull
+#define OP_TICK 3ull
+#define USER_DATA(op, index) (((op) << 56) | (index))
+
+typedef struct
+{
+    DHCPMessage msg;
+    struct sockaddr_in dest;
+    struct iovec iov;
+    struct msghdr hdr;
+} SendSlot;
+
+struct UringEngine
+{
+    int ring_fd;
+    int sockfd;
+
+    // Submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned to_submit;
+
+    // Completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // Provided receive buffers, handed back to the kernel after processing
+    struct io_uring_buf_ring *buf_ring;
+    uint8_t *buffers;
+    uint16_t buf_tail;
+    struct msghdr recv_hdr; // Template for the multishot recvmsg
+
+    SendSlot *slots;
+    int free_slots[SEND_SLOTS];
+    int free_count;
+
+    struct __kernel_timespec tick;
+
+    // Statistics
+    uint64_t received;
+    uint64_t sent;
+    uint64_t enters;
+};
+
+int uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+int uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+struct io_uring_sqe *get_sqe(UringEngine *engine)
+{
+    unsigned head = __atomic_load_n(engine->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *engine->sq_tail + engine->to_submit;
+    if (tail - head >= URING_ENTRIES)
+        return NULL;
+    struct io_uring_sqe *sqe = &engine->sqes[tail & engine->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    engine->sq_array[tail & engine->sq_mask] = tail & engine->sq_mask;
+    engine->to_submit++;
+    return sqe;
+}
+
+// Publishes the queued SQEs and optionally waits for at least one completion
+int submit(UringEngine *engine, int wait)
+{
+    __atomic_store_n(engine->sq_tail, *engine->sq_tail + engine->to_submit, __ATOMIC_RELEASE);
+    unsigned count = engine->to_submit;
+    engine->to_submit = 0;
+
+    int ret;
+    do
+    {
+        ret = uring_enter(engine->ring_fd, count, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+    } while (ret < 0 && errno == EINTR);
+    engine->enters++;
+    return ret;
+}
+
+void queue_recv(UringEngine *engine)
+{
+    struct io_uring_sqe *sqe = get_sqe(engine);
+    if (!sqe)
+    {
+        submit(engine, 0);
+        sqe = get_sqe(engine);
+    }
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = engine->sockfd;
+    sqe->addr = (uint64_t)(uintptr_t)&engine->recv_hdr;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = USER_DATA(OP_RECV, 0);
+}
+
+void queue_tick(UringEngine *engine)
+{
+    struct io_uring_sqe *sqe = get_sqe(engine);
+    if (!sqe)
+    {
+        submit(engine, 0);
+        sqe = get_sqe(engine);
+    }
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)&engine->tick;
+    sqe->len = 1;
+    sqe->user_data = USER_DATA(OP_TICK, 0);
+}
+
+void recycle_buffer(UringEngine *engine, uint16_t bid)
+{
+    struct io_uring_buf *buf = &engine->buf_ring->bufs[engine->buf_tail & (RECV_BUFFERS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(engine->buffers + (size_t)bid * RECV_BUFFER_SIZE);
+    buf->len = RECV_BUFFER_SIZE;
+    buf->bid = bid;
+    engine->buf_tail++;
+    __atomic_store_n(&engine->buf_ring->tail, engine->buf_tail, __ATOMIC_RELEASE);
+}
+
+// ReplySink callback: copies the reply into a send slot and queues a sendmsg
+// that goes out with the next io_uring_enter
+void uring_deliver(void *arg, DHCPMessage *reply, struct sockaddr_in *dest)
+{
+    UringEngine *engine = arg;
+    struct io_uring_sqe *sqe = engine->free_count ? get_sqe(engine) : NULL;
+    if (!sqe)
+    {
+        // Ring or send slots exhausted, don't hold the reply back
+        sendto(engine->sockfd, reply, sizeof(*reply), 0, (struct sockaddr *)dest, sizeof(*dest));
+        engine->sent++;
+        return;
+    }
+
+    int index = engine->free_slots[--engine->free_count];
+    SendSlot *slot = &engine->slots[index];
+    slot->msg = *reply;
+    slot->dest = *dest;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = engine->sockfd;
+    sqe->addr = (uint64_t)(uintptr_t)&slot->hdr;
+    sqe->len = 1;
+    sqe->user_data = USER_DATA(OP_SEND, index);
+}
+
+void handle_recv(UringEngine *engine, struct io_uring_cqe *cqe)
+{
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        queue_recv(engine); // Multishot ended (buffers ran out or error), re-arm
+
+    if (cqe->res < 0)
+    {
+        if (cqe->res != -ENOBUFS)
+            fprintf(stderr, "Error receiving data: %s\n", strerror(-cqe->res));
+        return;
+    }
+    if (!(cqe->flags & IORING_CQE_F_BUFFER))
+        return;
+
+    uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    uint8_t *buffer = engine->buffers + (size_t)bid * RECV_BUFFER_SIZE;
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buffer;
+    uint8_t *name = buffer + sizeof(*out);
+    uint8_t *payload = name + engine->recv_hdr.msg_namelen + engine->recv_hdr.msg_controllen;
+
+    // Parsed in place, the datagram is never copied out of the ring buffer
+    if (!(out->flags & MSG_TRUNC) && out->namelen >= sizeof(struct sockaddr_in))
+    {
+        struct sockaddr_in client_addr;
+        memcpy(&client_addr, name, sizeof(client_addr));
+        ReplySink sink = {engine->sockfd, uring_deliver, engine};
+        process_dhcp_message(&sink, (DHCPMessage *)payload, out->payloadlen, &client_addr);
+        engine->received++;
+    }
+    recycle_buffer(engine, bid);
+}
+
+UringEngine *uring_engine_create(int sockfd)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = URING_CQ_ENTRIES;
+
+    int fd = uring_setup(URING_ENTRIES, &params);
+    if (fd < 0)
+    {
+        perror("io_uring_setup");
+        return NULL;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        fprintf(stderr, "io_uring: kernel too old (no single mmap)\n");
+        close(fd);
+        return NULL;
+    }
+
+    UringEngine *engine = calloc(1, sizeof(UringEngine));
+    engine->ring_fd = fd;
+    engine->sockfd = sockfd;
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+    uint8_t *ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    engine->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring == MAP_FAILED || engine->sqes == MAP_FAILED)
+    {
+        perror("io_uring mmap");
+        close(fd);
+        free(engine);
+        return NULL;
+    }
+    engine->sq_head = (unsigned *)(ring + params.sq_off.head);
+    engine->sq_tail = (unsigned *)(ring + params.sq_off.tail);
+    engine->sq_mask = *(unsigned *)(ring + params.sq_off.ring_mask);
+    engine->sq_array = (unsigned *)(ring + params.sq_off.array);
+    engine->cq_head = (unsigned *)(ring + params.cq_off.head);
+    engine->cq_tail = (unsigned *)(ring + params.cq_off.tail);
+    engine->cq_mask = *(unsigned *)(ring + params.cq_off.ring_mask);
+    engine->cqes = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+
+    // Register the receive buffer ring (kernel 5.19+)
+    engine->buf_ring = mmap(NULL, RECV_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    engine->buffers = malloc((size_t)RECV_BUFFERS * RECV_BUFFER_SIZE);
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)engine->buf_ring;
+    reg.ring_entries = RECV_BUFFERS;
+    reg.bgid = BUFFER_GROUP;
+    if (engine->buf_ring == MAP_FAILED || uring_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        perror("io_uring buffer ring");
+        close(fd);
+        free(engine->buffers);
+        free(engine);
+        return NULL;
+    }
+    for (uint16_t bid = 0; bid < RECV_BUFFERS; bid++)
+        recycle_buffer(engine, bid);
+
+    engine->recv_hdr.msg_namelen = sizeof(struct sockaddr_in);
+
+    engine->slots = calloc(SEND_SLOTS, sizeof(SendSlot));
+    for (int i = 0; i < SEND_SLOTS; i++)
+    {
+        SendSlot *slot = &engine->slots[i];
+        slot->iov.iov_base = &slot->msg;
+        slot->iov.iov_len = sizeof(DHCPMessage);
+        slot->hdr.msg_name = &slot->dest;
+        slot->hdr.msg_namelen = sizeof(slot->dest);
+        slot->hdr.msg_iov = &slot->iov;
+        slot->hdr.msg_iovlen = 1;
+        engine->free_slots[engine->free_count++] = i;
+    }
+
+    engine->tick.tv_sec = 1; // Lease expiry check every second
+    return engine;
+}
+
+void uring_engine_run(UringEngine *engine)
+{
+    queue_recv(engine);
+    queue_tick(engine);
+
+    while (1)
+    {
+        if (submit(engine, 1) < 0 && errno != EBUSY)
+        {
+            perror("io_uring_enter");
+            return;
+        }
+
+        unsigned head = *engine->cq_head;
+        unsigned tail = __atomic_load_n(engine->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe *cqe = &engine->cqes[head & engine->cq_mask];
+            uint64_t op = cqe->user_data >> 56;
+
+            if (op == OP_RECV)
+            {
+                handle_recv(engine, cqe);
+            }
+            else if (op == OP_SEND)
+            {
+                if (cqe->res < 0)
+                    fprintf(stderr, "Error sending reply: %s\n", strerror(-cqe->res));
+                engine->free_slots[engine->free_count++] = cqe->user_data & 0xffffffff;
+                engine->sent++;
+            }
+            else if (op == OP_TICK)
+            {
+                pthread_mutex_lock(&mutex);
+                expire_leases(time(NULL));
+                update_pool_stats();
+                pthread_mutex_unlock(&mutex);
+                queue_tick(engine);
+            }
+
+            // Hand the slot back early so the kernel can keep posting
+            __atomic_store_n(engine->cq_head, head + 1, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+void uring_engine_stats(UringEngine *engine, uint64_t *received, uint64_t *sent, uint64_t *enters)
+{
+    *received = engine->received;
+    *sent = engine->sent;
+    *enters = engine->enters;
+}